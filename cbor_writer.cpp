@@ -0,0 +1,167 @@
+#include <apptools/cbor_writer.h>
+#include <cmath>
+#include <cstring>
+
+#define CBOR_UINT 0
+#define CBOR_NEGINT 1
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+
+#define CBOR_FALSE 0xf4
+#define CBOR_TRUE 0xf5
+#define CBOR_NULL 0xf6
+#define CBOR_FLOAT32 0xfa
+#define CBOR_FLOAT64 0xfb
+#define CBOR_INDEFINITE 31
+#define CBOR_BREAK 0xff
+
+static const double POW10[] = {1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+
+bool cbor_writer::put(uint8_t b) {
+    if (len_ + 1 > size_)
+        return false;
+    buffer_[len_++] = b;
+    return true;
+}
+
+bool cbor_writer::put(const void *p, size_t n) {
+    if (len_ + n > size_)
+        return false;
+    memcpy(buffer_ + len_, p, n);
+    len_ += n;
+    return true;
+}
+
+// initial byte plus the shortest big endian argument
+bool cbor_writer::put_head(uint8_t major, uint64_t v) {
+    uint8_t head[9];
+    size_t n;
+    if (v < 24) {
+        head[0] = (major << 5) | (uint8_t) v;
+        n = 1;
+    } else if (v <= UINT8_MAX) {
+        head[0] = (major << 5) | 24;
+        n = 2;
+    } else if (v <= UINT16_MAX) {
+        head[0] = (major << 5) | 25;
+        n = 3;
+    } else if (v <= UINT32_MAX) {
+        head[0] = (major << 5) | 26;
+        n = 5;
+    } else {
+        head[0] = (major << 5) | 27;
+        n = 9;
+    }
+    for (size_t i = n - 1; i > 0; i--) {
+        head[i] = (uint8_t) v;
+        v >>= 8;
+    }
+    return put(head, n);
+}
+
+bool cbor_writer::put_text(const char *s) {
+    size_t n = strlen(s);
+    return put_head(CBOR_TEXT, n) && put(s, n);
+}
+
+cbor_writer &cbor_writer::fail(size_t m) {
+    rollback(m);
+    dropped_++;
+    return *this;
+}
+
+cbor_writer &cbor_writer::begin_map(const char *k) {
+    size_t m = mark();
+    if ((k && !put_text(k)) || !put((uint8_t) ((CBOR_MAP << 5) | CBOR_INDEFINITE)))
+        return fail(m);
+    return *this;
+}
+
+cbor_writer &cbor_writer::begin_array(const char *k) {
+    size_t m = mark();
+    if ((k && !put_text(k)) || !put((uint8_t) ((CBOR_ARRAY << 5) | CBOR_INDEFINITE)))
+        return fail(m);
+    return *this;
+}
+
+cbor_writer &cbor_writer::end() {
+    if (!put((uint8_t) CBOR_BREAK))
+        dropped_++;
+    return *this;
+}
+
+cbor_writer &cbor_writer::key(const char *k) {
+    size_t m = mark();
+    if (!put_text(k))
+        return fail(m);
+    return *this;
+}
+
+cbor_writer &cbor_writer::value(const char *str) {
+    if (!str)
+        return null();
+    size_t m = mark();
+    if (!put_text(str))
+        return fail(m);
+    return *this;
+}
+
+cbor_writer &cbor_writer::value(bool v) {
+    if (!put((uint8_t) (v ? CBOR_TRUE : CBOR_FALSE)))
+        dropped_++;
+    return *this;
+}
+
+cbor_writer &cbor_writer::null() {
+    if (!put((uint8_t) CBOR_NULL))
+        dropped_++;
+    return *this;
+}
+
+cbor_writer &cbor_writer::value_int(int64_t v) {
+    size_t m = mark();
+    bool ok = v >= 0 ? put_head(CBOR_UINT, (uint64_t) v) : put_head(CBOR_NEGINT, (uint64_t) (-1 - v));
+    if (!ok)
+        return fail(m);
+    return *this;
+}
+
+cbor_writer &cbor_writer::value(double v, int decimals) {
+    if (!std::isfinite(v))
+        return null();
+
+    if (decimals < 0)
+        decimals = 0;
+    if (decimals > 9)
+        decimals = 9;
+
+    // rounded like json_writer does, a value has to hash the same as long as its decimals do not change
+    double scaled = fabs(v) * POW10[decimals] + 0.5;
+    if (scaled < 9.0e15) {
+        double rounded = floor(scaled) / POW10[decimals];
+        v = v < 0 && rounded != 0 ? -rounded : rounded;
+    }
+
+    size_t m = mark();
+    uint8_t out[9];
+    float f = (float) v;
+    if (fabs(v - (double) f) * POW10[decimals] < 0.5) {
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        out[0] = CBOR_FLOAT32;
+        for (int i = 4; i > 0; i--, bits >>= 8)
+            out[i] = (uint8_t) bits;
+        if (!put(out, 5))
+            return fail(m);
+    } else {
+        uint64_t bits;
+        memcpy(&bits, &v, sizeof(bits));
+        out[0] = CBOR_FLOAT64;
+        for (int i = 8; i > 0; i--, bits >>= 8)
+            out[i] = (uint8_t) bits;
+        if (!put(out, 9))
+            return fail(m);
+    }
+    return *this;
+}
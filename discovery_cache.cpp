@@ -0,0 +1,39 @@
+#include <apptools/discovery_cache.h>
+#include <apptools/hash_utils.h>
+
+bool discovery_cache::set(const char *topic, const source_t &source, const char *payload, size_t len) {
+    uint32_t hash = fnv1a_32(payload, len);
+
+    for (auto &entry : entries_) {
+        if (entry.topic != topic)
+            continue;
+        entry.source = source;
+        if (entry.hash == hash && entry.len == len)
+            return false;
+        entry.hash = hash;
+        entry.len = (uint16_t) len;
+        entry.dirty = true;
+        return true;
+    }
+
+    entries_.push_back({topic, source, hash, (uint16_t) len, true});
+    return true;
+}
+
+void discovery_cache::invalidate() {
+    for (auto &entry : entries_)
+        entry.dirty = true;
+}
+
+size_t discovery_cache::pending() const {
+    size_t count = 0;
+    for (const auto &entry : entries_) {
+        if (entry.dirty)
+            count++;
+    }
+    return count;
+}
+
+size_t discovery_cache::footprint() const {
+    return entries_.capacity() * sizeof(entry_t);
+}
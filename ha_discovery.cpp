@@ -1,11 +1,331 @@
 #include <apptools/ha_discovery.h>
 #include <string.h>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include "cJSON.h"
 
 namespace ha_discovery {
+    payload_writer_t::payload_writer_t(char *buffer, size_t size, state_encoding_t encoding)
+        : encoding_(encoding), json_(buffer, size), cbor_(buffer, size) {
+        if (binary()) {
+            cbor_.begin_map();
+            cbor_.reserve(1);
+        } else {
+            json_.begin_object();
+            json_.reserve(1);
+        }
+    }
+
+    // all or nothing - a key without its value is worse than a missing field
+    void payload_writer_t::commit(const mark_t &m, uint32_t dropped) {
+        if (this->dropped() != dropped) {
+            rollback(m);
+            return;
+        }
+        fields_++;
+    }
+
+    void payload_writer_t::add(const char *key, bool value) {
+        auto m = mark();
+        uint32_t dropped = this->dropped();
+        if (binary())
+            cbor_.field(key, value);
+        else
+            json_.field(key, value);
+        commit(m, dropped);
+    }
+
+    void payload_writer_t::add(const char *key, double value, int decimals) {
+        if (aggregator_ && aggregator_->absorb(key, value, now_ms_))
+            return;
+        if (filter_ && !filter_->empty())
+            value = filter_->apply(key, value);
+        auto m = mark();
+        uint32_t dropped = this->dropped();
+        if (binary())
+            cbor_.field(key, value, decimals);
+        else
+            json_.field(key, value, decimals);
+        commit(m, dropped);
+    }
+
+    void payload_writer_t::add(const char *key, const char *value) {
+        auto m = mark();
+        uint32_t dropped = this->dropped();
+        if (binary())
+            cbor_.field(key, value);
+        else
+            json_.field(key, value);
+        commit(m, dropped);
+    }
+
+    void payload_writer_t::add_int(const char *key, int64_t value) {
+        if (aggregator_ && aggregator_->absorb(key, (double) value, now_ms_))
+            return;
+        if (filter_ && !filter_->empty())
+            value = (int64_t) filter_->apply(key, (double) value);
+        auto m = mark();
+        uint32_t dropped = this->dropped();
+        if (binary())
+            cbor_.key(key).value_int(value);
+        else
+            json_.key(key).value_int(value);
+        commit(m, dropped);
+    }
+
+    void payload_writer_t::add_raw(const char *fragment, size_t len) {
+        if (binary()) {
+            add_raw_cbor(fragment, len);
+            return;
+        }
+        auto m = mark();
+        uint32_t dropped = json_.dropped();
+        json_.raw(fragment, len);
+        commit(m, dropped);
+    }
+
+    // legacy PayloadFunc sensors in cbor mode - slow, but they already pay for a std::string
+    void payload_writer_t::add_raw_cbor(const char *fragment, size_t len) {
+        std::string object;
+        object.reserve(len + 2);
+        object.append(1, '{').append(fragment, len).append(1, '}');
+        cJSON *root = cJSON_Parse(object.c_str());
+        if (!root)
+            return;
+
+        cJSON *item;
+        cJSON_ArrayForEach(item, root) {
+            if (cJSON_IsBool(item)) {
+                add(item->string, (bool) cJSON_IsTrue(item));
+            } else if (cJSON_IsNumber(item)) {
+                double v = item->valuedouble;
+                if (fabs(v) < 9.0e15 && v == (double) (int64_t) v)
+                    add_int(item->string, (int64_t) v);
+                else
+                    add(item->string, v, 6);
+            } else if (cJSON_IsString(item)) {
+                add(item->string, item->valuestring);
+            } else if (cJSON_IsNull(item)) {
+                auto m = mark();
+                uint32_t dropped = cbor_.dropped();
+                cbor_.key(item->string).null();
+                commit(m, dropped);
+            }
+            // nested objects and arrays have no value_key to land on
+        }
+        cJSON_Delete(root);
+    }
+
+    size_t payload_writer_t::finish() {
+        if (binary()) {
+            cbor_.release(1);
+            cbor_.end();
+            return cbor_.length();
+        }
+        json_.release(1);
+        json_.end_object();
+        return json_.length();
+    }
+
+    const char *payload_writer_t::written_since(const mark_t &m, size_t *len) const {
+        if (binary()) {
+            *len = cbor_.length() - m.cbor;
+            return cbor_.data() + m.cbor;
+        }
+        size_t start = m.json.len;
+        if (m.fields > 0 && fields_ > m.fields)
+            start += 1; // ','
+        *len = json_.length() - start;
+        return json_.data() + start;
+    }
+
     sensor_wrapper_t::sensor_wrapper_t(uint32_t min_intervall_ms, DiscoveryFunc discovery, PayloadFunc payload)
         : discoveryFunc_(discovery), payloadFunc_(payload), min_intervall_ms_(min_intervall_ms) {
     }
 
+    sensor_wrapper_t::sensor_wrapper_t(uint32_t min_intervall_ms, DiscoveryFunc discovery, WriterFunc writer)
+        : discoveryFunc_(discovery), writerFunc_(writer), min_intervall_ms_(min_intervall_ms) {
+    }
+
+    std::string sensor_wrapper_t::get_payload() const {
+        if (payloadFunc_)
+            return payloadFunc_();
+
+        char buffer[256];
+        payload_writer_t writer(buffer, sizeof(buffer));
+        auto start = writer.mark();
+        writerFunc_(writer);
+        size_t len;
+        const char *fragment = writer.written_since(start, &len);
+        return std::string(fragment, len);
+    }
+
+    void sensor_wrapper_t::write_payload(payload_writer_t &writer) const {
+        if (writerFunc_) {
+            writerFunc_(writer);
+            return;
+        }
+
+        std::string fragment = payloadFunc_();
+        if (!fragment.empty())
+            writer.add_raw(fragment.data(), fragment.size());
+    }
+
+    void sensor_wrapper_t::on_command(const char *value_key, CommandFunc func) {
+        for (auto &command : commands_) {
+            if (strcmp(command.first, value_key) == 0) {
+                command.second = func;
+                return;
+            }
+        }
+        commands_.emplace_back(value_key, func);
+    }
+
+    const sensor_wrapper_t::CommandFunc *sensor_wrapper_t::command_handler(const char *value_key) const {
+        for (const auto &command : commands_) {
+            if (strcmp(command.first, value_key) == 0)
+                return &command.second;
+        }
+        return nullptr;
+    }
+
+    std::vector<control_config_t> sensor_wrapper_t::get_control_config() const {
+        std::vector<control_config_t> configs = discoveryFunc_();
+        aggregator_.add_configs(configs);
+        for (auto &config : configs)
+            config.update_interval_ms = min_intervall_ms_;
+        return configs;
+    }
+
+    void sensor_wrapper_t::aggregate(const char *value_key, int decimals) {
+        aggregator_.add(value_key, decimals);
+    }
+
+    static const char *const s_aggregate_suffix[] = {"min", "max", "mean", "count"};
+
+    void aggregator_t::add(const char *value_key, int decimals) {
+        for (auto &window : windows_) {
+            if (strcmp(window->key, value_key) == 0) {
+                window->decimals = decimals;
+                return;
+            }
+        }
+
+        std::unique_ptr<window_t> window(new window_t());
+        window->key = value_key;
+        window->decimals = decimals;
+        for (int kind = 0; kind < AGG_KINDS; kind++) {
+            snprintf(window->keys[kind], MAX_KEY_LENGTH, "%s_%s", value_key, s_aggregate_suffix[kind]);
+        }
+        windows_.push_back(std::move(window));
+    }
+
+    bool aggregator_t::absorb(const char *value_key, double value, int64_t now_ms) {
+        for (auto &window : windows_) {
+            if (strcmp(window->key, value_key) != 0)
+                continue;
+            if (!std::isfinite(value))
+                return true;
+            if (window_start_ms_ == 0)
+                window_start_ms_ = now_ms;
+            if (window->count == 0) {
+                window->min = window->max = value;
+                window->sum = 0;
+            } else {
+                window->min = std::min(window->min, value);
+                window->max = std::max(window->max, value);
+            }
+            window->sum += value;
+            window->last = value;
+            window->count++;
+            return true;
+        }
+        return false;
+    }
+
+    bool aggregator_t::due(int64_t now_ms) const {
+        return window_start_ms_ != 0 && now_ms - window_start_ms_ >= window_ms_;
+    }
+
+    void aggregator_t::flush(payload_writer_t &writer, int64_t now_ms) {
+        for (auto &window : windows_) {
+            if (window->count == 0)
+                continue;
+            writer.add(window->key, window->last, window->decimals);
+            writer.add(window->keys[AGG_MIN], window->min, window->decimals);
+            writer.add(window->keys[AGG_MAX], window->max, window->decimals);
+            writer.add(window->keys[AGG_MEAN], window->sum / window->count, window->decimals);
+            writer.add(window->keys[AGG_COUNT], window->count);
+            window->count = 0;
+        }
+        window_start_ms_ = now_ms;
+    }
+
+    void aggregator_t::add_configs(std::vector<control_config_t> &configs) const {
+        size_t plain = configs.size();
+        for (const auto &window : windows_) {
+            for (size_t i = 0; i < plain; i++) {
+                if (strcmp(configs[i].value_key, window->key) != 0)
+                    continue;
+                configs[i].update_window_s = (window_ms_ + 999) / 1000;
+                control_config_t config = configs[i]; // push_back below may move configs
+                for (int kind = 0; kind < AGG_KINDS; kind++) {
+                    snprintf(window->names[kind], MAX_KEY_LENGTH, "%s %s", config.name, s_aggregate_suffix[kind]);
+                    control_config_t aggregate = control_config_t::make_sensor(window->names[kind], window->keys[kind]);
+                    aggregate.update_window_s = config.update_window_s;
+                    if (kind != AGG_COUNT) {
+                        aggregate.unit = config.unit;
+                        aggregate.device_class = config.device_class;
+                    }
+                    configs.push_back(aggregate);
+                }
+                break;
+            }
+        }
+    }
+
+    void sensor_wrapper_t::set_deadband(const char *value_key, float absolute, float relative) {
+        deadband_.set(value_key, absolute, relative);
+    }
+
+    void deadband_filter_t::set(const char *value_key, float absolute, float relative) {
+        for (auto &band : bands_) {
+            if (strcmp(band.key, value_key) == 0) {
+                band.absolute = absolute;
+                band.relative = relative;
+                return;
+            }
+        }
+        bands_.push_back({value_key, absolute, relative, 0, 0, false, false});
+    }
+
+    double deadband_filter_t::apply(const char *value_key, double value) {
+        for (auto &band : bands_) {
+            if (strcmp(band.key, value_key) != 0)
+                continue;
+            if (band.has_sent && std::isfinite(value)) {
+                double width = std::max<double>(band.absolute, fabs(band.sent) * band.relative);
+                if (fabs(value - band.sent) < width)
+                    return band.sent;
+            }
+            band.pending = value;
+            band.has_pending = true;
+            return value;
+        }
+        return value;
+    }
+
+    void deadband_filter_t::commit() {
+        for (auto &band : bands_) {
+            if (band.has_pending) {
+                band.sent = band.pending;
+                band.has_sent = true;
+                band.has_pending = false;
+            }
+        }
+    }
+
     std::shared_ptr<device_info_t> device_info_t::make_shared(const char *eid,
                                                               const char *name,
                                                               const char *model,
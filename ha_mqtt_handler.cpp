@@ -3,20 +3,135 @@
 #include "esp_log.h"
 #include "apptools/log_collector.h"
 #include "apptools/system_stats.h"
+#include "apptools/hash_utils.h"
+#include "apptools/json_writer.h"
 
 static const char *TAG = "mqtt_handler_ota";
 
 #define MAX_TOPIC_LEN 256
 #define MAX_PAYLOAD_LEN 1024
 #define MQTT_ROOT_TOPIC "huzza32"
+#define HA_STATUS_TOPIC "homeassistant/status"
+#define MIN_STATE_INTERVAL_MS 100 // never poll a sensor faster than the old 10hz tick
+#define BUILT_IN_SENSOR_INTERVAL_MS 10000
+#define EXPIRE_AFTER_S 30
+#define EXPIRE_REFRESH_MARGIN_MS 5000 // republish unchanged values this long before HA expires them
+#define LOG_EXPIRY_S 300 // mqtt 5 - a log chunk older than this is not worth delivering
+#define MQTT5_REFUSE_PROTOCOL 0x84 // connack reason code "unsupported protocol version"
+#define GOVERNOR_PERIOD_MS 1000
+#define OUTBOX_POLL_MS 1000 // how often we look at the outbox while state is held back
 
 ha_mqtt_handler::ha_mqtt_handler(const esp_mqtt_client_config_t *mqtt_config, const device_config_t *config,
                                    ota_handler *ota_handler) : mqtt_client_(esp_mqtt_client_init(mqtt_config)),
                                                                config_(config),
-                                                               ota_handler_(ota_handler) {
+                                                               ota_handler_(ota_handler),
+                                                               registry_mutex_(xSemaphoreCreateRecursiveMutex()),
+                                                               discovery_mutex_(xSemaphoreCreateMutex()) {
+    keep_config(mqtt_config);
 }
 
-void ha_mqtt_handler::start() {
+// the caller's config only has to live until esp_mqtt_client_init returned, the fallback needs it later
+// a 3.1.1 config never falls back - nothing is kept
+void ha_mqtt_handler::keep_config(const esp_mqtt_client_config_t *mqtt_config) {
+    if (mqtt_config->session.protocol_ver != MQTT_PROTOCOL_V_5)
+        return;
+    // the digital signature context is opaque, it can not be copied
+    if (mqtt_config->credentials.authentication.ds_data) {
+        ESP_LOGW(TAG, "MQTT 5 with a DS peripheral key - no fallback to 3.1.1");
+        return;
+    }
+
+    mqtt_config_ = *mqtt_config;
+    fallback_ = true;
+    keep_string(mqtt_config_.broker.address.uri);
+    keep_string(mqtt_config_.broker.address.hostname);
+    keep_string(mqtt_config_.broker.address.path);
+    keep_string(mqtt_config_.broker.verification.certificate, mqtt_config_.broker.verification.certificate_len);
+    keep_string(mqtt_config_.broker.verification.common_name);
+    keep_string(mqtt_config_.credentials.username);
+    keep_string(mqtt_config_.credentials.client_id);
+    keep_string(mqtt_config_.credentials.authentication.password);
+    keep_string(mqtt_config_.credentials.authentication.certificate, mqtt_config_.credentials.authentication.certificate_len);
+    keep_string(mqtt_config_.credentials.authentication.key, mqtt_config_.credentials.authentication.key_len);
+    keep_string(mqtt_config_.credentials.authentication.key_password, mqtt_config_.credentials.authentication.key_password_len);
+    keep_string(mqtt_config_.session.last_will.topic);
+    keep_string(mqtt_config_.session.last_will.msg, mqtt_config_.session.last_will.msg_len);
+
+    auto &verification = mqtt_config_.broker.verification;
+    if (verification.alpn_protos) {
+        size_t count = 0;
+        while (verification.alpn_protos[count])
+            count++;
+        auto protos = (const char **) keep_bytes(verification.alpn_protos, (count + 1) * sizeof(const char *));
+        for (size_t i = 0; i < count; i++)
+            keep_string(protos[i]);
+        verification.alpn_protos = protos;
+    }
+    if (verification.psk_hint_key) {
+        auto psk = (psk_key_hint *) keep_bytes(verification.psk_hint_key, sizeof(psk_key_hint));
+        if (psk->key)
+            psk->key = (const uint8_t *) keep_bytes(psk->key, psk->key_size);
+        keep_string(psk->hint);
+        verification.psk_hint_key = psk;
+    }
+    if (mqtt_config_.network.if_name)
+        mqtt_config_.network.if_name = (struct ifreq *) keep_bytes(mqtt_config_.network.if_name, sizeof(struct ifreq));
+}
+
+// len 0 == null terminated
+void ha_mqtt_handler::keep_string(const char *&str, size_t len) {
+    if (!str)
+        return;
+    if (len == 0)
+        len = strlen(str) + 1;
+    str = (const char *) keep_bytes(str, len);
+}
+
+// owned by mqtt_config_strings_
+void *ha_mqtt_handler::keep_bytes(const void *data, size_t len) {
+    char *copy = new char[len];
+    memcpy(copy, data, len);
+    mqtt_config_strings_.emplace_back(copy);
+    return copy;
+}
+
+// default ha config
+static const ha_discovery::control_config_t s_builtin_controls[] = {
+    ha_discovery::control_config_t::make_button("reboot", "reboot_button")
+};
+
+static const ha_discovery::control_config_t s_builtin_sensors[] = {
+    {"sensor", "uptime", "uptime", "s", 0, 0, 0, nullptr, "duration", nullptr, 0},
+    {"sensor", "cpu_load", "cpu_load", "%", 0, 100, 0.1, nullptr, nullptr, nullptr, 0},
+    {"sensor", "free_memory", "free_memory", "bytes", 0, 0, 0, nullptr, nullptr, nullptr, 0},
+    // publish path telemetry, percentiles cover the last BUILT_IN_SENSOR_INTERVAL_MS
+    {"sensor", "tx_bytes_per_s", "tx_bytes_per_s", "B/s", 0, 0, 0, nullptr, "data_rate", nullptr, 0},
+    {"sensor", "publish_failures", "publish_failures", nullptr, 0, 0, 0, nullptr, nullptr, nullptr, 0},
+    {"sensor", "publish_dropped", "publish_dropped", nullptr, 0, 0, 0, nullptr, nullptr, nullptr, 0},
+    {"sensor", "state_build_p95_us", "state_build_p95_us", "us", 0, 0, 0, nullptr, nullptr, nullptr, 0},
+    {"sensor", "state_enqueue_p95_us", "state_enqueue_p95_us", "us", 0, 0, 0, nullptr, nullptr, nullptr, 0},
+    {"sensor", "discovery_p95_us", "discovery_p95_us", "us", 0, 0, 0, nullptr, nullptr, nullptr, 0},
+    {"sensor", "log_send_p95_us", "log_send_p95_us", "us", 0, 0, 0, nullptr, nullptr, nullptr, 0},
+    {"sensor", "publish_stretch", "publish_stretch", "%", 0, 0, 0, nullptr, nullptr, nullptr, 0}
+};
+
+
+void ha_mqtt_handler::start(const publisher_config_t &publisher) {
+    xSemaphoreTakeRecursive(registry_mutex_, portMAX_DELAY);
+    intern_topics();
+    cache_builtin_discovery();
+    xSemaphoreGiveRecursive(registry_mutex_);
+    discovery_messages_.set_rate(publisher.discovery_messages_per_s);
+    discovery_bytes_.set_rate(publisher.discovery_bytes_per_s);
+    gate_.set_client(mqtt_client_);
+    gate_.set_telemetry(&telemetry_);
+    governor_.configure(publisher.governor);
+    gate_.set_budget(publisher.outbox_budget_bytes);
+    gate_.set_topic_alias_max(publisher.topic_aliases);
+    // nobody wants state older than HA's expire_after delivered after an outage
+    gate_.set_message_expiry(publish_gate::PRIORITY_STATE, EXPIRE_AFTER_S);
+    gate_.set_message_expiry(publish_gate::PRIORITY_LOG, LOG_EXPIRY_S);
+
     auto err = esp_mqtt_client_start(mqtt_client_);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to start MQTT client: %s", esp_err_to_name(err));
@@ -30,19 +145,39 @@ void ha_mqtt_handler::start() {
     // it seems that if we start to quick here - kernel crashes...
     vTaskDelay(2000 / portTICK_PERIOD_MS);
 
-    // Start a timer to publish uptime every minute
+    // One-shot timer, publish_state() re-arms it for the next sensor deadline
     esp_timer_create_args_t timer_args = {
-        .callback = &publish_state_wrapper,
+        .callback = &state_timer_wrapper,
         .arg = this,
         .name = "state_timer"
     };
     esp_timer_create(&timer_args, &state_timer_);
-    esp_timer_start_periodic(state_timer_, 100000); // 10hz
+
+    ESP_LOGI(TAG, "Interned %d topics, %d bytes", (int) topics_.count(), (int) topics_.footprint());
+
+    schedule_dirty_ = true;
+    TaskHandle_t task = nullptr;
+    if (xTaskCreatePinnedToCore(publisher_task_wrapper, "ha_publisher", publisher.stack_size, this,
+                                publisher.priority, &task, publisher.core_id) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create publisher task");
+        return;
+    }
+    publisher_task_ = task;
+    wake_publisher();
 }
 
 ha_mqtt_handler::~ha_mqtt_handler() {
     log_collector_->detach_callback();
     log_collector_ = nullptr;
+    // let the publisher finish its current round - it clears publisher_task_ on exit
+    if (publisher_task_) {
+        publisher_stop_ = true;
+        xTaskNotifyGive(publisher_task_);
+        while (publisher_task_) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+    }
+
     // Stop and delete the timer
     if (state_timer_) {
         esp_timer_stop(state_timer_);
@@ -56,9 +191,67 @@ ha_mqtt_handler::~ha_mqtt_handler() {
         esp_mqtt_client_destroy(mqtt_client_);
         mqtt_client_ = nullptr;
     }
+
+    release_reassembly();
+
+    if (discovery_mutex_) {
+        vSemaphoreDelete(discovery_mutex_);
+        discovery_mutex_ = nullptr;
+    }
+
+    if (registry_mutex_) {
+        vSemaphoreDelete(registry_mutex_);
+        registry_mutex_ = nullptr;
+    }
+}
+
+void ha_mqtt_handler::intern_topics() {
+    // lazily since the device config might not be loaded when we are constructed
+    xSemaphoreTakeRecursive(registry_mutex_, portMAX_DELAY);
+    if (state_topic_) {
+        xSemaphoreGiveRecursive(registry_mutex_);
+        return;
+    }
+
+    state_topic_ = topics_.intern("%s/%s/state", MQTT_ROOT_TOPIC, config_->eid);
+    state_cbor_topic_ = topics_.intern("%s/%s/state/cbor", MQTT_ROOT_TOPIC, config_->eid);
+    logs_topic_ = topics_.intern("%s/%s/logs", MQTT_ROOT_TOPIC, config_->eid);
+
+    add_command_route(topics_.intern("%s/%s/%s/set", MQTT_ROOT_TOPIC, config_->eid, "config_string"),
+        [](const char *data, int data_len) {
+            ESP_LOGI(TAG, "config string received: %.*s", data_len, data);
+        });
+
+    add_command_route(topics_.intern("%s/%s/%s/set", MQTT_ROOT_TOPIC, config_->eid, "ota_string"),
+        [this](const char *data, int data_len) {
+            ESP_LOGI(TAG, "OTA string received for main device");
+            ota_handler_->handle_ota_update(terminated(data, data_len));
+        });
+
+    add_command_route(topics_.intern("%s/%s/%s/set", MQTT_ROOT_TOPIC, config_->eid, "reboot_button"),
+        [this](const char *, int) {
+            ESP_LOGI(TAG, "Reboot button pressed");
+            reboot_pending_ = true;
+        });
+
+    // home assistant restarted - it has forgotten our entities
+    registry_.update([this](registry_t &registry) {
+        registry.router.add(HA_STATUS_TOPIC, [this](const char *data, int data_len) {
+            if (data_len == 6 && strncmp(data, "online", 6) == 0) {
+                ESP_LOGI(TAG, "Home Assistant online - republishing discovery");
+                xSemaphoreTake(discovery_mutex_, portMAX_DELAY);
+                discovery_cache_.invalidate();
+                xSemaphoreGive(discovery_mutex_);
+                publish_pending_discovery();
+                request_full_state();
+            }
+        });
+    });
+    xSemaphoreGiveRecursive(registry_mutex_);
 }
 
 void ha_mqtt_handler::enable_logging(LogCollector* p) {
+    intern_topics();
     log_collector_ = p;
     log_collector_->set_callback(
              [this](const char* data, size_t len) {
@@ -68,30 +261,70 @@ void ha_mqtt_handler::enable_logging(LogCollector* p) {
 }
 
 void ha_mqtt_handler::send_logs(const char* logs, size_t size) {
-    char topic[MAX_TOPIC_LEN];
-    snprintf(topic, sizeof(topic), "%s/%s/logs", MQTT_ROOT_TOPIC, config_->eid);
+    // no logging in here - every line would be captured and sent by the next flush, and so on
+    gate_.publish(logs_topic_, logs, size, 0, 0, publish_gate::PRIORITY_LOG);
+}
 
-    esp_mqtt_client_publish(mqtt_client_, topic, logs, size, 0, 0);
+void ha_mqtt_handler::add_sensor(std::shared_ptr<ha_discovery::sensor_wrapper_t> sensor) {
+    xSemaphoreTakeRecursive(registry_mutex_, portMAX_DELAY);
+    intern_topics();
+    add_sensor_commands(*sensor, nullptr);
+    registry_.update([&sensor](registry_t &registry) {
+        registry.sensors.push_back(sensor);
+    });
+    cache_discovery(*sensor);
+    xSemaphoreGiveRecursive(registry_mutex_);
+    if (connected_)
+        publish_pending_discovery();
+    schedule_dirty_ = true;
+    wake_publisher();
 }
 
 void ha_mqtt_handler::add_managed_device(std::shared_ptr<ha_discovery::device_info_t> p) {
     // TODO SHOULD WE BE ABLE TO REDISCOVER UPDATED SENSORS - IE UPDATED VERSIONS?
-    sub_devices_.push_back(p);
+    // sensors must be added to the device before it is handed over here
+    xSemaphoreTakeRecursive(registry_mutex_, portMAX_DELAY);
+    intern_topics();
+    const char *state_topic = topics_.intern("%s/%s/%s/state", MQTT_ROOT_TOPIC, config_->eid, p->eid());
+    const char *cbor_topic = topics_.intern("%s/cbor", state_topic);
+    for (const auto &sensor : p->sensors()) {
+        add_sensor_commands(*sensor, p.get());
+    }
     subscribe_topics(p);
-    publish_discovery(p);
+    // the device and its state topics show up together, the publisher indexes them by device
+    registry_.update([&](registry_t &registry) {
+        registry.sub_devices.push_back(p);
+        registry.sub_device_state_topics.push_back(state_topic);
+        registry.sub_device_cbor_topics.push_back(cbor_topic);
+    });
+    cache_discovery(p, state_topic);
+    xSemaphoreGiveRecursive(registry_mutex_);
+    if (connected_)
+        publish_pending_discovery();
+    schedule_dirty_ = true;
+    wake_publisher();
 }
 
 void ha_mqtt_handler::update_managed_device(const char* eid, const char* sw_tag, const char* sw_sha256) {
-    auto it = std::find_if(sub_devices_.begin(), sub_devices_.end(),
+    xSemaphoreTakeRecursive(registry_mutex_, portMAX_DELAY);
+    const registry_t &registry = registry_.current();
+    auto it = std::find_if(registry.sub_devices.begin(), registry.sub_devices.end(),
         [eid](const std::shared_ptr<ha_discovery::device_info_t>& device) {
             return (strcmp(device->eid(), eid)==0);
         });
 
-    if (it != sub_devices_.end()) {
+    if (it != registry.sub_devices.end()) {
+        // the publisher renders discovery from the device under discovery_mutex_
+        xSemaphoreTake(discovery_mutex_, portMAX_DELAY);
         (*it)->set_sw_tag(sw_tag);
         (*it)->set_sw_sha256(sw_sha256);
-        publish_discovery(*it); // Re-publish discovery info with updated metadata
+        xSemaphoreGive(discovery_mutex_);
+        // Re-publish discovery info with updated metadata
+        cache_discovery(*it, registry.sub_device_state_topics[it - registry.sub_devices.begin()]);
+        if (connected_)
+            publish_pending_discovery();
     }
+    xSemaphoreGiveRecursive(registry_mutex_);
 }
 /*void mqtt_handler_ota::add_device_sensor(const char* eid, std::shared_ptr<SensorWrapper> sensor) {
     for (const auto& config : sensor->getDiscoveryConfigs()) {
@@ -112,21 +345,27 @@ void ha_mqtt_handler::event_handler(esp_event_base_t base, int32_t event_id, voi
     switch (event->event_id) {
         case MQTT_EVENT_CONNECTED: {
             ESP_LOGI(TAG, "MQTT Connected");
+            connected_ = true;
+            gate_.set_mqtt5(event->protocol_ver == MQTT_PROTOCOL_V_5);
+            gate_.set_connected(true);
             publish_auto_discovery();
-            publish_state();
         }
         break;
         case MQTT_EVENT_DISCONNECTED:
             ESP_LOGI(TAG, "MQTT Disconnected");
+            connected_ = false;
+            gate_.set_connected(false);
+            break;
+        case MQTT_EVENT_ERROR:
+            handle_connect_error(event);
             break;
         case MQTT_EVENT_SUBSCRIBED:
             ESP_LOGI(TAG, "MQTT Subscribed");
             break;
         case MQTT_EVENT_DATA: {
             ESP_LOGI(TAG, "MQTT Data Received");
-            if (strstr(event->topic, "/set") != nullptr) {
-                handle_control_message(event->topic, event->topic_len, event->data, event->data_len);
-            }
+            auto registry = registry_.read();
+            handle_data(*registry, event);
         }
         break;
         default:
@@ -134,408 +373,685 @@ void ha_mqtt_handler::event_handler(esp_event_base_t base, int32_t event_id, voi
     }
 }
 
-void ha_mqtt_handler::handle_control_message(const char *topic, int topic_len, const char *data, int data_len) {
-    // I want this allocation to go on the heap
-    static char topic_str[MAX_TOPIC_LEN];
-    static char value[MAX_PAYLOAD_LEN];
+// a 3.1.1 only broker refuses the mqtt 5 connect - retry with 3.1.1 instead of failing forever
+void ha_mqtt_handler::handle_connect_error(esp_mqtt_event_handle_t event) {
+    const esp_mqtt_error_codes_t *error = event->error_handle;
+    if (!error || error->error_type != MQTT_ERROR_TYPE_CONNECTION_REFUSED)
+        return;
+    if (!fallback_)
+        return;
+    if (error->connect_return_code != MQTT_CONNECTION_REFUSE_PROTOCOL &&
+        (int) error->connect_return_code != MQTT5_REFUSE_PROTOCOL)
+        return;
+
+    ESP_LOGW(TAG, "Broker refused MQTT 5 - falling back to 3.1.1");
+    mqtt_config_.session.protocol_ver = MQTT_PROTOCOL_V_3_1_1;
+    fallback_ = false;
+    esp_err_t err = esp_mqtt_set_config(mqtt_client_, &mqtt_config_);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to switch to MQTT 3.1.1: %s", esp_err_to_name(err));
+    }
+}
 
-    // Safely copy the topic
-    int safe_topic_len = std::min(topic_len, (int) sizeof(topic_str) - 1);
-    strncpy(topic_str, topic, safe_topic_len);
-    topic_str[safe_topic_len] = '\0';
+void ha_mqtt_handler::handle_data(const registry_t &registry, esp_mqtt_event_handle_t event) {
+    // the whole message in one event - the common case
+    if (event->current_data_offset == 0 && event->data_len == event->total_data_len) {
+        handle_control_message(registry, event->topic, event->topic_len, event->data, event->data_len);
+        return;
+    }
 
-    // Safely copy the value
-    int safe_data_len = std::min(data_len, (int) sizeof(value) - 1);
-    strncpy(value, data, safe_data_len);
-    value[safe_data_len] = '\0';
+    // only the first fragment carries the topic
+    if (event->current_data_offset == 0) {
+        release_reassembly();
+        inflight_topic_ = nullptr;
 
-    ESP_LOGI(TAG, "Received control message - Topic: %s, Value: %s", topic_str, value);
+        const topic_router::route_t *route = registry.router.find(event->topic, event->topic_len);
+        if (!route) {
+            ESP_LOGW(TAG, "No route for topic: %.*s", event->topic_len, event->topic);
+            return;
+        }
 
+        if (!route->chunk_handler) {
+            if ((size_t) event->total_data_len > max_message_size_) {
+                ESP_LOGE(TAG, "Message on %s is %d bytes, limit is %d - dropped",
+                         route->topic, event->total_data_len, (int) max_message_size_);
+                return;
+            }
+            reassembly_ = (char *) malloc(event->total_data_len + 1);
+            if (!reassembly_) {
+                ESP_LOGE(TAG, "No memory to reassemble %d bytes on %s", event->total_data_len, route->topic);
+                return;
+            }
+            reassembly_len_ = event->total_data_len;
+        }
+        inflight_topic_ = route->topic;
+        inflight_topic_len_ = route->topic_len;
+    }
 
-    // Parse topic structure: huzza32/<device_id>/<sub_device_id>/ota_string/set
-    char *topic_parts[5];
-    char *topic_copy = strdup(topic_str);
-    char *token = strtok(topic_copy, "/");
-    int part_count = 0;
+    if (!inflight_topic_)
+        return; // rest of a dropped message
+
+    bool last = event->current_data_offset + event->data_len >= event->total_data_len;
+    const topic_router::route_t *route = registry.router.find(inflight_topic_, inflight_topic_len_);
+    if (route && route->chunk_handler) {
+        route->chunk_handler(event->data, event->data_len, event->current_data_offset, event->total_data_len);
+    } else if (reassembly_ && event->current_data_offset + event->data_len <= reassembly_len_) {
+        memcpy(reassembly_ + event->current_data_offset, event->data, event->data_len);
+        if (last) {
+            reassembly_[reassembly_len_] = '\0';
+            handle_control_message(registry, inflight_topic_, inflight_topic_len_, reassembly_, reassembly_len_);
+        }
+    } else {
+        ESP_LOGE(TAG, "Unexpected fragment on %s - dropped", inflight_topic_);
+        last = true;
+    }
 
-    while (token != nullptr && part_count < 5) {
-        topic_parts[part_count++] = token;
-        token = strtok(nullptr, "/");
+    if (last) {
+        release_reassembly();
+        inflight_topic_ = nullptr;
     }
+}
+
+void ha_mqtt_handler::release_reassembly() {
+    free(reassembly_);
+    reassembly_ = nullptr;
+    reassembly_len_ = 0;
+}
 
-    // Check if this is a sub-device OTA request
-    if (part_count == 5 && strcmp(topic_parts[3], "ota_string") == 0) {
-        const char* sub_device_id = topic_parts[2];
+// the ota handlers parse with cJSON and want a terminated string - reassembled messages already are
+const char *ha_mqtt_handler::terminated(const char *data, int data_len) const {
+    if (data == reassembly_)
+        return data;
 
-        // Find the corresponding sub-device
-        auto it = std::find_if(sub_devices_.begin(), sub_devices_.end(),
-            [sub_device_id](const std::shared_ptr<ha_discovery::device_info_t>& device) {
-                return (strcmp(device->eid(), sub_device_id) == 0);
-            });
+    static char value[MAX_PAYLOAD_LEN];
+    int len = std::min(data_len, (int) sizeof(value) - 1);
+    memcpy(value, data, len);
+    value[len] = '\0';
+    return value;
+}
 
-        if (it != sub_devices_.end()) {
-            ESP_LOGI(TAG, "Processing OTA for sub-device: %s", sub_device_id);
-            // Call OTA proxy with the found device and OTA string
-            ota_handler_->handle_subdevice_ota((*it).get(), value);
+void ha_mqtt_handler::handle_control_message(const registry_t &registry, const char *topic, int topic_len,
+                                             const char *data, int data_len) {
+    ESP_LOGI(TAG, "Received control message - Topic: %.*s, Value: %.*s", topic_len, topic, data_len, data);
 
-        } else {
-            ESP_LOGE(TAG, "Sub-device not found: %s", sub_device_id);
-        }
+    if (!registry.router.dispatch(topic, topic_len, data, data_len)) {
+        ESP_LOGW(TAG, "No route for topic: %.*s", topic_len, topic);
+    }
+}
 
-    } else if (strstr(topic_str, "ota_string") != nullptr) {
-        // Handle main device OTA
-        ESP_LOGI(TAG, "OTA string received for main device: %s", value);
-        ota_handler_->handle_ota_update(value);
+void ha_mqtt_handler::track_command_topic(registry_t &registry, const char *topic) {
+    auto &topics = registry.command_topics;
+    if (std::find(topics.begin(), topics.end(), topic) == topics.end())
+        topics.push_back(topic);
+}
 
-    } else if (strstr(topic_str, "config_string") != nullptr) {
-        ESP_LOGI(TAG, "config string received: %s", value);
+void ha_mqtt_handler::add_command_route(const char *topic, topic_router::handler_t handler) {
+    if (!topic)
+        return;
+    xSemaphoreTakeRecursive(registry_mutex_, portMAX_DELAY);
+    registry_.update([&](registry_t &registry) {
+        registry.router.add(topic, handler);
+        track_command_topic(registry, topic);
+    });
+    xSemaphoreGiveRecursive(registry_mutex_);
+    if (connected_)
+        esp_mqtt_client_subscribe(mqtt_client_, topic, 0);
+}
 
-    } else if (strstr(topic_str, "reboot_button") != nullptr) {
-        ESP_LOGI(TAG, "Reboot button pressed");
-        reboot_pending_ = true;
+void ha_mqtt_handler::add_chunked_command(const char *value_key, topic_router::chunk_handler_t handler) {
+    xSemaphoreTakeRecursive(registry_mutex_, portMAX_DELAY);
+    intern_topics();
+    const char *topic = command_topic(nullptr, value_key);
+    if (topic) {
+        registry_.update([&](registry_t &registry) {
+            registry.router.add_chunked(topic, handler);
+            track_command_topic(registry, topic);
+        });
     }
+    xSemaphoreGiveRecursive(registry_mutex_);
+    if (topic && connected_)
+        esp_mqtt_client_subscribe(mqtt_client_, topic, 0);
 }
 
-void ha_mqtt_handler::publish_auto_discovery() {
-    // we could move this to a better structure since we dont export to ha
-    ha_discovery::control_config_t subscriptions[] = {
-        ha_discovery::control_config_t::make_subscribed_text("config", "config_string"),
-        ha_discovery::control_config_t::make_subscribed_text("ota", "ota_string"),
-    };
+// main device entities: root/eid/key/set, sub device entities: root/eid/sub_eid/key/set
+const char *ha_mqtt_handler::command_topic(const ha_discovery::device_info_t *device, const char *value_key) {
+    if (!device)
+        return topics_.intern("%s/%s/%s/set", MQTT_ROOT_TOPIC, config_->eid, value_key);
+    return topics_.intern("%s/%s/%s/%s/set", MQTT_ROOT_TOPIC, config_->eid, device->eid(), value_key);
+}
 
-    // default ha config
-    ha_discovery::control_config_t builtin_controls[] = {
-        ha_discovery::control_config_t::make_button("reboot", "reboot_button")
-    };
+void ha_mqtt_handler::add_sensor_commands(const ha_discovery::sensor_wrapper_t &sensor,
+                                          const ha_discovery::device_info_t *device) {
+    for (const auto &config : sensor.get_control_config()) {
+        if (!config.is_controllable)
+            continue;
+        const auto *handler = sensor.command_handler(config.value_key);
+        if (!handler) {
+            ESP_LOGW(TAG, "No command handler for controllable entity %s", config.value_key);
+            continue;
+        }
+        add_command_route(command_topic(device, config.value_key), *handler);
+    }
+}
 
-    ha_discovery::control_config_t builtin_sensors[] = {
-        {"sensor", "uptime", "uptime", "s", 0, 0, 0, nullptr, "duration", nullptr, 0},
-        {"sensor", "cpu_load", "cpu_load", "%", 0, 100, 0.1, nullptr, nullptr, nullptr, 0},
-        {"sensor", "free_memory", "free_memory", "bytes", 0, 0, 0, nullptr, nullptr, nullptr, 0}
-    };
+void ha_mqtt_handler::cache_builtin_discovery() {
+    xSemaphoreTake(discovery_mutex_, portMAX_DELAY);
+    uint16_t index = 0;
+    for (const auto &control: s_builtin_controls) {
+        cache_discovery(control, {nullptr, nullptr, state_topic_, nullptr, index++});
+    }
 
-    for (const auto &control: builtin_controls) {
-        publish_discovery(control);
+    for (const auto &sensor: s_builtin_sensors) {
+        cache_discovery(sensor, {nullptr, nullptr, state_topic_, nullptr, index++});
     }
+    xSemaphoreGive(discovery_mutex_);
+}
 
-    for (const auto &sensor: builtin_sensors) {
-        publish_discovery(sensor);
+void ha_mqtt_handler::publish_pending_discovery() {
+    // the publisher task trickles them out in pump_discovery()
+    if (!discovery_pending_.exchange(true)) {
+        xSemaphoreTake(discovery_mutex_, portMAX_DELAY);
+        discovery_sent_ = 0;
+        discovery_sent_bytes_ = 0;
+        discovery_round_start_ms_ = esp_timer_get_time() / 1000;
+        xSemaphoreGive(discovery_mutex_);
+    }
+    wake_publisher();
+}
+
+// returns when it wants to run again, INT64_MAX if there is nothing left to send
+// discovery_mutex_ is never held while publishing - the mqtt task takes it while holding the client lock
+int64_t ha_mqtt_handler::pump_discovery(int64_t now_ms) {
+    // publisher only, published outside discovery_mutex_
+    static char payload[MAX_PAYLOAD_LEN];
+
+    if (!discovery_pending_ || !connected_)
+        return INT64_MAX;
+
+    int64_t wake = INT64_MAX;
+    bool done = true;
+
+    xSemaphoreTake(discovery_mutex_, portMAX_DELAY);
+    discovery_messages_.refill(now_ms);
+    discovery_bytes_.refill(now_ms);
+    for (size_t i = 0; ; i++) {
+        auto &entries = discovery_cache_.entries();
+        while (i < entries.size() && !entries[i].dirty)
+            i++;
+        if (i == entries.size()) {
+            // home assistant restarted while we published - start over
+            if (discovery_cache_.pending() == 0)
+                break;
+            i = SIZE_MAX; // 0 after the increment
+            continue;
+        }
+
+        uint32_t len = entries[i].len;
+        if (!discovery_messages_.can_take(1) || !discovery_bytes_.can_take(len)) {
+            wake = now_ms + std::max(discovery_messages_.wait_ms(1), discovery_bytes_.wait_ms(len));
+            done = false;
+            break;
+        }
+
+        // rendered into our own buffer, registration may replace the entry while we publish
+        const char *topic = entries[i].topic;
+        uint32_t hash = entries[i].hash;
+        len = render_discovery(entries[i].source, payload, sizeof(payload));
+        if (len == 0) {
+            entries[i].dirty = false;
+            continue;
+        }
+        xSemaphoreGive(discovery_mutex_);
+
+        // retained so the broker hands it to home assistant - we do not have to resend on every reconnect
+        int msg_id = gate_.publish(topic, payload, len, 1, 1, publish_gate::PRIORITY_DISCOVERY);
+
+        xSemaphoreTake(discovery_mutex_, portMAX_DELAY);
+        if (msg_id < 0) {
+            ESP_LOGW(TAG, "Discovery publish failed for %s - retrying later", topic);
+            wake = now_ms + 1000;
+            done = false;
+            break;
+        }
+        discovery_messages_.take(1);
+        discovery_bytes_.take(len);
+        discovery_sent_++;
+        discovery_sent_bytes_ += len;
+        // the content changed in the meantime - send it again
+        auto &current = discovery_cache_.entries();
+        if (i < current.size() && current[i].topic == topic && current[i].hash == hash)
+            current[i].dirty = false;
+        else
+            i--;
     }
 
-    for (const auto& sensor : sensors_) {
-        for (const auto& config : sensor->get_control_config()) {
-            publish_discovery(config);
+    if (done) {
+        discovery_pending_ = false;
+        if (discovery_sent_ > 0) {
+            ESP_LOGI(TAG, "Published %d of %d discovery messages (%d bytes) in %d ms, cache %d bytes",
+                     (int) discovery_sent_, (int) discovery_cache_.size(), (int) discovery_sent_bytes_,
+                     (int) (now_ms - discovery_round_start_ms_), (int) discovery_cache_.footprint());
         }
+    } else {
+        ESP_LOGD(TAG, "Discovery progress %d/%d", (int) discovery_sent_,
+                 (int) (discovery_sent_ + discovery_cache_.pending()));
     }
+    xSemaphoreGive(discovery_mutex_);
+    return wake;
+}
+
+discovery_progress_t ha_mqtt_handler::discovery_progress() {
+    xSemaphoreTake(discovery_mutex_, portMAX_DELAY);
+    discovery_progress_t progress = {discovery_sent_, discovery_cache_.pending(), discovery_cache_.size()};
+    xSemaphoreGive(discovery_mutex_);
+    return progress;
+}
+
+void ha_mqtt_handler::publish_auto_discovery() {
+    publish_pending_discovery();
 
-    for (auto& sub_device : sub_devices_ )
-       publish_discovery(sub_device);
+    esp_mqtt_client_subscribe(mqtt_client_, HA_STATUS_TOPIC, 0);
 
-    for (const auto &subscription: subscriptions) {
-            char topic[128];
-            snprintf(topic, sizeof(topic), "%s/%s/%s/set", MQTT_ROOT_TOPIC, config_->eid, subscription.value_key);
+    // includes the sub devices - the broker may have dropped our session
+    auto registry = registry_.read();
+    for (const char *topic : registry->command_topics) {
             esp_mqtt_client_subscribe(mqtt_client_, topic, 0);
             ESP_LOGI(TAG, "Subscribed to topic: %s", topic);
     }
 
-    for (const auto &control: builtin_controls) {
-            char topic[128];
-            snprintf(topic, sizeof(topic), "%s/%s/%s/set", MQTT_ROOT_TOPIC, config_->eid, control.value_key);
-            esp_mqtt_client_subscribe(mqtt_client_, topic, 0);
-            ESP_LOGI(TAG, "Subscribed to topic: %s", topic);
+    request_full_state();
+}
+
+void ha_mqtt_handler::rebuild_schedule(const registry_t &registry) {
+    scheduler_.clear();
+
+    uint16_t slot = 0;
+    scheduler_.push({built_in_sensor_next_ts_, nullptr, publish_scheduler::MAIN_DEVICE, slot++});
+    for (const auto& sensor : registry.sensors) {
+        scheduler_.push({sensor->next_update_ms(), sensor.get(), publish_scheduler::MAIN_DEVICE, slot++});
     }
 
-    publish_state();
+    for (size_t i = 0; i < registry.sub_devices.size(); i++) {
+        slot = 0;
+        for (const auto& sensor : registry.sub_devices[i]->sensors()) {
+            scheduler_.push({sensor->next_update_ms(), sensor.get(), (int16_t) i, slot++});
+        }
+    }
+    ESP_LOGI(TAG, "Scheduled %d sensors", (int) scheduler_.size());
 }
 
-void ha_mqtt_handler::publish_state() {
-    // Alloc on heap
-    static char topic[MAX_TOPIC_LEN];
-    static char payload[MAX_PAYLOAD_LEN];
+void ha_mqtt_handler::request_full_state() {
+    force_publish_ = true;
+    wake_publisher();
+}
 
-    snprintf(topic, sizeof(topic), "%s/%s/state", MQTT_ROOT_TOPIC, config_->eid);
+void ha_mqtt_handler::wake_publisher() {
+    TaskHandle_t task = publisher_task_;
+    if (task)
+        xTaskNotifyGive(task);
+}
 
-    int payload_len=0;
+void ha_mqtt_handler::arm_state_timer(int64_t delay_ms) {
+    if (!state_timer_)
+        return;
+    esp_timer_stop(state_timer_); // fails if not running - that is fine
+    esp_timer_start_once(state_timer_, std::max<int64_t>(delay_ms, 1) * 1000);
+}
 
-    int64_t now = esp_timer_get_time()/1000;
+// HA's expire_after for an entity polled every interval_ms - slow sensors get one refresh margin past their poll
+static uint32_t expire_after_s(uint32_t interval_ms) {
+    return std::max<uint32_t>(EXPIRE_AFTER_S, (interval_ms + EXPIRE_REFRESH_MARGIN_MS + 999) / 1000);
+}
 
-    if (built_in_sensor_next_ts_ < now){
-      built_in_sensor_next_ts_ = now + 10000; // 10s on builtin stuff
+static uint32_t expire_after_s(const ha_discovery::sensor_wrapper_t *sensor) {
+    return expire_after_s(sensor ? sensor->min_intervall_ms() : BUILT_IN_SENSOR_INTERVAL_MS);
+}
 
-      int64_t uptime_seconds = now / 1000;
-      float cpu_load = get_cpu_load().total;
-      uint32_t free_memory = esp_get_free_heap_size();
+// no sensor may be stretched past the point where HA expires it
+static uint32_t max_interval_ms(const ha_discovery::sensor_wrapper_t *sensor) {
+    uint32_t cap = expire_after_s(sensor) * 1000 - EXPIRE_REFRESH_MARGIN_MS;
+    if (sensor && sensor->max_intervall_ms() > 0)
+        return std::min(sensor->max_intervall_ms(), cap);
+    return cap;
+}
 
-      payload_len = snprintf(payload, sizeof(payload),
-             "{\"uptime\": %lld, \"cpu_load\": %.1f, \"free_memory\": %lu",
-             uptime_seconds, cpu_load, free_memory);
+void ha_mqtt_handler::update_governor(int64_t now_ms) {
+    if (!governor_.enabled() || now_ms < governor_next_ms_)
+        return;
+    governor_next_ms_ = now_ms + GOVERNOR_PERIOD_MS;
+
+    size_t budget = gate_.budget();
+    uint32_t outbox_pct = budget > 0 ? gate_.outbox_size() * 100 / budget : 0;
+    uint16_t before = governor_.stretch_pct();
+    governor_.update(get_cpu_load().total, esp_get_free_heap_size(), outbox_pct);
+    if (governor_.stretch_pct() != before) {
+        ESP_LOGD(TAG, "Publish intervals at %d%% (pressure %d%%)", governor_.stretch_pct(), governor_.pressure_pct());
     }
+}
 
-    for (const auto& sensor : sensors_) {
-        std::string sensor_payload = sensor->get_payload();
-        if (!sensor_payload.empty()) {
-            //first?
-            if (payload_len==0){
-              payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                                    "{%s", sensor_payload.c_str());
-            } else {
-               payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                                    ", %s", sensor_payload.c_str());
-            }
-        }
-    }
-    if (payload_len>0){
-      // Close the JSON object
-      payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len, "}");
-      esp_mqtt_client_publish(mqtt_client_, topic, payload, 0, 0, 0);
-      //ESP_LOGI(TAG, "Published state: %s", payload);
-    }
+// changed since last publish - or the next poll would come after HA expires the entity
+static bool is_stale(const ha_discovery::sensor_wrapper_t &sensor, uint32_t hash, int64_t now_ms, uint32_t interval_ms) {
+    if (hash != sensor.last_payload_hash())
+        return true;
+    if (sensor.max_silence_ms() > 0 && now_ms - sensor.last_publish_ms() >= sensor.max_silence_ms())
+        return true;
+    return now_ms + interval_ms - sensor.last_publish_ms() >= expire_after_s(&sensor) * 1000 - EXPIRE_REFRESH_MARGIN_MS;
+}
 
+void ha_mqtt_handler::publish_state(const registry_t &registry, bool rebuild) {
+    // Alloc on heap
+    static char payload[MAX_PAYLOAD_LEN];
 
-     // Now publish each subdevice state separately
-    for (const auto& subdevice : sub_devices_) {
-        // Create unique topic for each subdevice
-        snprintf(topic, sizeof(topic), "%s/%s/%s/state",
-                MQTT_ROOT_TOPIC, config_->eid, subdevice->eid());
+    int64_t now = esp_timer_get_time()/1000;
 
-        // Reset payload buffer
-        payload_len = snprintf(payload, sizeof(payload), "{");
-        bool first_sensor = true;
+    if (rebuild) {
+        rebuild_schedule(registry);
+    }
 
-        // Add all sensors for this subdevice
-        for (const auto& sensor : subdevice->sensors()) {
-            std::string sensor_payload = sensor->get_payload();
-            if (!sensor_payload.empty()) {
-                if (!first_sensor) {
-                    payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len, ", ");
+    due_.clear();
+    bool force = force_publish_.exchange(false);
+    scheduler_.pop_due(now, force, due_);
+
+    // due_ is grouped per device - one state message per device
+    size_t i = 0;
+    while (i < due_.size()) {
+        int16_t device = due_[i].device;
+        ha_discovery::state_encoding_t encoding = state_encoding_;
+        bool cbor = encoding == ha_discovery::state_encoding_t::CBOR;
+        const char *topic;
+        if (device == publish_scheduler::MAIN_DEVICE)
+            topic = cbor ? state_cbor_topic_ : state_topic_;
+        else
+            topic = cbor ? registry.sub_device_cbor_topics[device] : registry.sub_device_state_topics[device];
+
+        int64_t build_start_us = esp_timer_get_time();
+        ha_discovery::payload_writer_t writer(payload, sizeof(payload), encoding);
+        for (; i < due_.size() && due_[i].device == device; i++) {
+            auto entry = due_[i];
+            if (entry.sensor == nullptr) {
+                writer.add("uptime", now / 1000);
+                // the governor samples the load already - a second caller would halve its window
+                writer.add("cpu_load", governor_.enabled() ? governor_.cpu_load() : get_cpu_load().total, 1);
+                writer.add("free_memory", esp_get_free_heap_size());
+                write_telemetry(writer, now);
+                writer.add("publish_stretch", governor_.stretch_pct());
+
+                built_in_sensor_next_ts_ = now + governor_.interval_ms(BUILT_IN_SENSOR_INTERVAL_MS, max_interval_ms(nullptr));
+                entry.deadline_ms = built_in_sensor_next_ts_;
+            } else {
+                uint32_t interval = governor_.interval_ms(
+                    std::max<uint32_t>(entry.sensor->min_intervall_ms(), MIN_STATE_INTERVAL_MS),
+                    max_interval_ms(entry.sensor));
+                auto mark = writer.mark();
+                // values inside a deadband come out as the last sent ones and hash the same
+                bool filtered = entry.sensor->has_deadband();
+                if (filtered)
+                    writer.set_filter(&entry.sensor->deadband());
+                if (entry.sensor->has_aggregation()) {
+                    // samples of aggregated keys are taken in, the window result goes out when it closes
+                    auto &aggregator = entry.sensor->aggregator();
+                    writer.set_aggregator(&aggregator, now);
+                    entry.sensor->write_payload(writer);
+                    writer.set_aggregator(nullptr, now);
+                    if (aggregator.due(now) || force)
+                        aggregator.flush(writer, now);
+                } else {
+                    entry.sensor->write_payload(writer);
+                }
+                writer.set_filter(nullptr);
+                if (writer.fields() > mark.fields) {
+                    size_t len;
+                    const char *written = writer.written_since(mark, &len);
+                    uint32_t hash = fnv1a_32(written, len);
+                    bool on_change = publish_on_change_ || filtered;
+                    if (!on_change || force || is_stale(*entry.sensor, hash, now, interval)) {
+                        entry.sensor->set_published(hash, now);
+                        if (filtered)
+                            entry.sensor->deadband().commit();
+                    } else {
+                        writer.rollback(mark);
+                    }
                 }
-                payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                                      "%s", sensor_payload.c_str());
-                first_sensor = false;
+                entry.deadline_ms = now + interval;
+                entry.sensor->set_next_update_ms(entry.deadline_ms);
             }
+            scheduler_.push(entry);
         }
 
-        // Close the subdevice JSON
-        payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len, "}");
+        if (writer.overflow()) {
+            ESP_LOGW(TAG, "State payload for %s truncated", topic);
+        }
 
-        // Publish subdevice state if we have any sensor data
-        if (payload_len > 2) {  // More than just "{}"
-            esp_mqtt_client_publish(mqtt_client_, topic, payload, 0, 0, 0);
-            //ESP_LOGI(TAG, "Published subdevice state for %s: %s", subdevice->eid(), payload);
+        if (writer.fields() > 0) {
+            size_t payload_len = writer.finish();
+            telemetry_.record(publish_telemetry::PATH_STATE_BUILD, esp_timer_get_time() - build_start_us,
+                              payload_len, !writer.overflow());
+            gate_.publish(topic, payload, payload_len, 0, 0, publish_gate::PRIORITY_STATE);
+            //ESP_LOGI(TAG, "Published state for %s: %.*s", topic, (int) payload_len, payload);
         }
     }
 
-
 }
-void ha_mqtt_handler::publish_discovery(const ha_discovery::control_config_t &config) {
-    static char discovery_topic[MAX_TOPIC_LEN];
-    static char payload[MAX_PAYLOAD_LEN];
 
-    snprintf(discovery_topic, sizeof(discovery_topic), "homeassistant/%s/%s_%s/config",
-             config.type, config_->eid, config.value_key);
-
-    int payload_len = snprintf(payload, sizeof(payload),
-                             "{"
-                             "\"name\":\"%s\","
-                             "\"state_topic\":\"%s/%s/state\","
-                             "\"unique_id\":\"%s_%s\","
-                             "\"device\":{"
-                             "\"identifiers\":[\"%s\"],"
-                             "\"name\":\"%s %.8s\","
-                             "\"model\":\"%s\","
-                             "\"manufacturer\":\"%s\","
-                             "\"hw_version\":\"%s\","
-                             "\"sw_version\":\"%s\""
-                             "},"
-                             "\"value_template\":\"{{ value_json.%s }}\"",
-                             config.name,
-                             MQTT_ROOT_TOPIC, config_->eid,
-                             config_->eid, config.value_key,
-                             config_->eid,
-                             config_->model, config_->eid,
-                             config_->model,
-                             config_->manufacturer,
-                             config_->hardware_revision,
-                             config_->software_revision,
-                             config.value_key);
-
-    // Only add command topic if the entity is controllable
-    if (config.is_controllable) {
-        payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                              ",\"command_topic\":\"%s/%s/%s/set\"",
-                              MQTT_ROOT_TOPIC, config_->eid, config.value_key);
+// counters are totals, rates and percentiles cover the time since the last built-in report
+void ha_mqtt_handler::write_telemetry(ha_discovery::payload_writer_t &writer, int64_t now_ms) {
+    publish_telemetry::path_stats_t window[publish_telemetry::PATH_COUNT];
+    uint32_t bytes = 0;
+    uint32_t failures = 0;
+    for (int path = 0; path < publish_telemetry::PATH_COUNT; path++) {
+        auto current = telemetry_.stats((publish_telemetry::path_t) path);
+        window[path] = current.since(telemetry_reported_[path]);
+        telemetry_reported_[path] = current;
+        if (path != publish_telemetry::PATH_STATE_BUILD) {
+            bytes += window[path].bytes;
+            failures += current.failures;
+        }
     }
 
-    // Handle different types with their specific configurations
+    int64_t elapsed_ms = now_ms - telemetry_reported_ms_;
+    telemetry_reported_ms_ = now_ms;
+    auto dropped = gate_.stats();
+
+    writer.add("tx_bytes_per_s", elapsed_ms > 0 ? (int64_t) bytes * 1000 / elapsed_ms : 0);
+    writer.add("publish_failures", failures);
+    writer.add("publish_dropped", dropped.dropped + dropped.coalesced);
+    writer.add("state_build_p95_us", window[publish_telemetry::PATH_STATE_BUILD].percentile_us(95));
+    writer.add("state_enqueue_p95_us", window[publish_telemetry::PATH_STATE].percentile_us(95));
+    writer.add("discovery_p95_us", window[publish_telemetry::PATH_DISCOVERY].percentile_us(95));
+    writer.add("log_send_p95_us", window[publish_telemetry::PATH_LOGS].percentile_us(95));
+}
+
+// type specific part of a discovery message, shared by the main device and sub devices
+static void write_entity_config(json_writer &json, const ha_discovery::control_config_t &config) {
+    json.string_begin("value_template").string_append("{{ value_json.").string_append(config.value_key)
+        .string_append(" }}").string_end();
+
     if (strcmp(config.type, "number") == 0) {
         if (config.min != config.max) {  // Only add if valid range is specified
-            payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                                  ",\"min\":%.1f,\"max\":%.1f", config.min, config.max);
+            json.field("min", config.min, 1).field("max", config.max, 1);
         }
         if (config.step > 0) {
-            payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                                  ",\"step\":%.2f", config.step);
+            json.field("step", config.step, 2);
         }
         if (config.mode) {
-            payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                                  ",\"mode\":\"%s\"", config.mode);
+            json.field("mode", config.mode);
         }
     } else if (strcmp(config.type, "select") == 0 && config.options && config.options_count > 0) {
-        payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len, ",\"options\":[");
+        json.begin_array("options");
         for (int i = 0; i < config.options_count; i++) {
-            payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                                  "\"%s\"%s", config.options[i], (i < config.options_count - 1) ? "," : "");
+            json.value(config.options[i]);
         }
-        payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len, "]");
+        json.end_array();
     } else if (strcmp(config.type, "switch") == 0 || strcmp(config.type, "binary_sensor") == 0) {
-        const char *s_on = config.state_on ? config.state_on : "ON";
-        const char *s_off = config.state_off ? config.state_off : "OFF";
-
-        payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                              ",\"state_on\":\"%s\",\"state_off\":\"%s\"", s_on, s_off);
+        json.field("state_on", config.state_on ? config.state_on : "ON");
+        json.field("state_off", config.state_off ? config.state_off : "OFF");
 
         if (config.is_controllable && config.payload_on && config.payload_off) {
-            payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                                  ",\"payload_on\":\"%s\",\"payload_off\":\"%s\"",
-                                  config.payload_on, config.payload_off);
+            json.field("payload_on", config.payload_on).field("payload_off", config.payload_off);
         }
     }
 
     // Add optional fields if present
     if (config.unit) {
-        payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                              ",\"unit_of_measurement\":\"%s\"", config.unit);
+        json.field("unit_of_measurement", config.unit);
     }
     if (config.device_class) {
-        payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                              ",\"device_class\":\"%s\"", config.device_class);
+        json.field("device_class", config.device_class);
     }
 
-    payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                          ",\"expire_after\":30}");
+    // aggregated values are written once per window, the refresh in is_stale() does not cover them
+    json.field("expire_after", expire_after_s(config.update_interval_ms) + config.update_window_s);
+}
+
+// the discovery message for one entity, 0 if it does not fit
+size_t ha_mqtt_handler::render_discovery(const ha_discovery::control_config_t &config,
+                                         const discovery_cache::source_t &source, char *payload, size_t size) {
+    const ha_discovery::device_info_t *device = source.device;
+
+    json_writer json(payload, size);
+    json.begin_object();
+    json.field("name", config.name);
+    json.field("state_topic", source.state_topic);
+    json.string_begin("unique_id").string_append(device ? device->eid() : config_->eid).string_append("_")
+        .string_append(config.value_key).string_end();
+
+    json.begin_object("device");
+    if (device) {
+        json.begin_array("identifiers").value(device->eid()).end_array();
+        json.field("name", device->name());
+        json.field("model", device->model());
+        json.field("manufacturer", "csi");
+        json.field("hw_version", device->hw_version());
+        json.string_begin("sw_version").string_append(device->sw_tag()).string_append(";SHA256:")
+            .string_append(device->sha256()).string_end();
+        json.field("via_device", config_->eid);
+    } else {
+        json.begin_array("identifiers").value(config_->eid).end_array();
+        json.string_begin("name").string_append(config_->model).string_append(" ")
+            .string_append(config_->eid, 8).string_end();
+        json.field("model", config_->model);
+        json.field("manufacturer", config_->manufacturer);
+        json.field("hw_version", config_->hardware_revision);
+        json.field("sw_version", config_->software_revision);
+    }
+    json.end_object();
 
-    esp_mqtt_client_publish(mqtt_client_, discovery_topic, payload, 0, 1, 0);
-    ESP_LOGI(TAG, "Published discovery for %s: sz=%d", config.name, payload_len);
+    // Only add command topic if the entity is controllable
+    if (source.command_topic) {
+        json.field("command_topic", source.command_topic);
+    }
+
+    write_entity_config(json, config);
+    json.end_object();
+    return json.overflow() ? 0 : json.length();
 }
 
-void ha_mqtt_handler::publish_discovery(std::shared_ptr<ha_discovery::device_info_t> device_info) {
-    // Alloc on heap
-    static char discovery_topic[MAX_TOPIC_LEN];
+// again from the source, the config of a sensor is asked for when it is sent
+size_t ha_mqtt_handler::render_discovery(const discovery_cache::source_t &source, char *payload, size_t size) {
+    if (!source.sensor) {
+        size_t controls = sizeof(s_builtin_controls) / sizeof(s_builtin_controls[0]);
+        const auto &config = source.index < controls ? s_builtin_controls[source.index]
+                                                     : s_builtin_sensors[source.index - controls];
+        return render_discovery(config, source, payload, size);
+    }
+    auto configs = source.sensor->get_control_config();
+    if (source.index >= configs.size())
+        return 0;
+    return render_discovery(configs[source.index], source, payload, size);
+}
+
+// rendered here only for the hash - discovery_mutex_ guards the static buffer, the cache and the topic table
+void ha_mqtt_handler::cache_discovery(const ha_discovery::control_config_t &config, discovery_cache::source_t source) {
     static char payload[MAX_PAYLOAD_LEN];
 
-    const char* device_manufacturer = "csi";
+    const char *eid = source.device ? source.device->eid() : config_->eid;
+    const char *discovery_topic = topics_.intern("homeassistant/%s/%s_%s/config", config.type, eid, config.value_key);
+    source.command_topic = config.is_controllable ? command_topic(source.device, config.value_key) : nullptr;
+
+    size_t len = render_discovery(config, source, payload, sizeof(payload));
+    if (len == 0 || !discovery_topic) {
+        ESP_LOGE(TAG, "Discovery for %s does not fit in %d bytes - skipped", config.name, MAX_PAYLOAD_LEN);
+    } else if (discovery_cache_.set(discovery_topic, source, payload, len)) {
+        ESP_LOGI(TAG, "Cached discovery for %s: sz=%d", config.name, (int) len);
+    }
+}
 
+void ha_mqtt_handler::cache_discovery(const ha_discovery::sensor_wrapper_t &sensor) {
+    xSemaphoreTake(discovery_mutex_, portMAX_DELAY);
+    uint16_t index = 0;
+    for (const auto &config : sensor.get_control_config()) {
+        cache_discovery(config, {nullptr, &sensor, state_topic_, nullptr, index++});
+    }
+    xSemaphoreGive(discovery_mutex_);
+}
+
+void ha_mqtt_handler::cache_discovery(std::shared_ptr<ha_discovery::device_info_t> device_info, const char *state_topic) {
+    xSemaphoreTake(discovery_mutex_, portMAX_DELAY);
     // Iterate through each sensor on the sub-device
     for (auto& sensor : device_info->sensors()) {
-        // Process each configuration for this sensor
+        uint16_t index = 0;
         for (auto& config : sensor->get_control_config()) {
-            snprintf(discovery_topic, sizeof(discovery_topic), "homeassistant/%s/%s_%s/config",
-                    config.type, device_info->eid(), config.value_key);
-
-            // Build the base configuration
-            int payload_len = snprintf(payload, sizeof(payload),
-                                     "{"
-                                     "\"name\":\"%s\","
-                                     "\"state_topic\":\"%s/%s/%s/state\","
-                                     "\"unique_id\":\"%s_%s\","
-                                     "\"device\":{"
-                                     "\"identifiers\":[\"%s\"],"
-                                     "\"name\":\"%s\","
-                                     "\"model\":\"%s\","
-                                     "\"manufacturer\":\"%s\","
-                                     "\"hw_version\":\"%s\","
-                                     "\"sw_version\":\"%s;SHA256:%s\","
-                                     "\"via_device\":\"%s\""
-                                     "},"
-                                     "\"value_template\":\"{{ value_json.%s }}\"",
-                                     config.name,
-                                     MQTT_ROOT_TOPIC, config_->eid, device_info->eid(),
-                                     device_info->eid(), config.value_key,
-                                     device_info->eid(),
-                                     device_info->name(),
-                                     device_info->model(),
-                                     device_manufacturer,
-                                     device_info->hw_version(),
-                                     device_info->sw_tag(), device_info->sha256(),
-                                     config_->eid,
-                                     config.value_key);
-
-            // Add command topic only if entity is controllable
-            // this seems wrong - we need  MQTT_ROOT_TOPIC, config_->eid, device_info->eid(),
-            if (config.is_controllable) {
-                payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                                      ",\"command_topic\":\"%s/%s/%s/set\"",
-                                      MQTT_ROOT_TOPIC, config_->eid, config.value_key);
-            }
-
-            // Handle type-specific configurations
-            if (strcmp(config.type, "number") == 0) {
-                if (config.min != config.max) {
-                    payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                                          ",\"min\":%.1f,\"max\":%.1f", config.min, config.max);
-                }
-                if (config.step > 0) {
-                    payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                                          ",\"step\":%.2f", config.step);
-                }
-                if (config.mode) {
-                    payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                                          ",\"mode\":\"%s\"", config.mode);
-                }
-            } else if (strcmp(config.type, "select") == 0 && config.options && config.options_count > 0) {
-                payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len, ",\"options\":[");
-                for (int i = 0; i < config.options_count; i++) {
-                    payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                                          "\"%s\"%s", config.options[i],
-                                          (i < config.options_count - 1) ? "," : "");
-                }
-                payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len, "]");
-            } else if (strcmp(config.type, "switch") == 0 || strcmp(config.type, "binary_sensor") == 0) {
-                const char *s_on = config.state_on ? config.state_on : "ON";
-                const char *s_off = config.state_off ? config.state_off : "OFF";
-
-                payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                                      ",\"state_on\":\"%s\",\"state_off\":\"%s\"", s_on, s_off);
-
-                if (config.is_controllable && config.payload_on && config.payload_off) {
-                    payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                                          ",\"payload_on\":\"%s\",\"payload_off\":\"%s\"",
-                                          config.payload_on, config.payload_off);
-                }
-            }
-
-            // Add optional fields
-            if (config.unit) {
-                payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                                      ",\"unit_of_measurement\":\"%s\"", config.unit);
-            }
-            if (config.device_class) {
-                payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                                      ",\"device_class\":\"%s\"", config.device_class);
-            }
-
-            // Add expiration
-            payload_len += snprintf(payload + payload_len, sizeof(payload) - payload_len,
-                                  ",\"expire_after\":30}");
-
-            // Publish discovery message
-            esp_mqtt_client_publish(mqtt_client_, discovery_topic, payload, 0, 1, 0);
-            ESP_LOGI(TAG, "Published discovery for subdevice %s: sz=%d", config.name, payload_len);
+            cache_discovery(config, {device_info.get(), sensor.get(), state_topic, nullptr, index++});
         }
     }
+    xSemaphoreGive(discovery_mutex_);
 }
 
 void ha_mqtt_handler::subscribe_topics(std::shared_ptr<ha_discovery::device_info_t> p) {
     ESP_LOGI(TAG, "Subscribing to topics");
-    char topic[256];
-    snprintf(topic, sizeof(topic), "%s/%s/%s/%s/set", MQTT_ROOT_TOPIC, config_->eid, p->eid(), "ota_string");
-    esp_mqtt_client_subscribe(mqtt_client_, topic, 0);
-    ESP_LOGI(TAG, "Subscribed to topic: %s", topic);
+    const char *topic = command_topic(p.get(), "ota_string");
+    add_command_route(topic, [this, p](const char *data, int data_len) {
+        ESP_LOGI(TAG, "Processing OTA for sub-device: %s", p->eid());
+        // Call OTA proxy with the found device and OTA string
+        ota_handler_->handle_subdevice_ota(p.get(), terminated(data, data_len));
+    });
+    ESP_LOGI(TAG, "Routed topic: %s", topic);
 }
 
 
-void ha_mqtt_handler::publish_state_wrapper(void* arg) {
+void ha_mqtt_handler::state_timer_wrapper(void* arg) {
+    // runs in the esp_timer task - keep it to a notification
     auto handler = static_cast<ha_mqtt_handler*>(arg);
-    handler->publish_state();
+    handler->wake_publisher();
+}
+
+void ha_mqtt_handler::publisher_task_wrapper(void* arg) {
+    auto handler = static_cast<ha_mqtt_handler*>(arg);
+    handler->publisher_loop();
+}
+
+void ha_mqtt_handler::publisher_loop() {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (publisher_stop_)
+            break;
+
+        // everything held back while the outbox was full is replaced by one full state message
+        if (gate_.take_recovered()) {
+            auto stats = gate_.stats();
+            ESP_LOGW(TAG, "Outbox drained - %u state messages coalesced, %u log chunks (%u bytes) dropped so far",
+                     (unsigned) stats.coalesced, (unsigned) stats.dropped, (unsigned) stats.dropped_bytes);
+            force_publish_ = true;
+        }
+        {
+            // pinned for one round - registration never waits for us
+            // the flag is taken first so a rebuild always sees the registration that asked for it
+            update_governor(esp_timer_get_time() / 1000);
+            bool rebuild = schedule_dirty_.exchange(false);
+            auto registry = registry_.read();
+            publish_state(*registry, rebuild);
+        }
+
+        // state first, then whatever the discovery budget allows
+        int64_t now = esp_timer_get_time() / 1000;
+        int64_t next = std::min(scheduler_.next_deadline_ms(), pump_discovery(now));
+        if (gate_.holding_state())
+            next = std::min(next, now + OUTBOX_POLL_MS);
+
+        // wake_publisher() calls made while we were busy are kept as a pending notification
+        arm_state_timer(next - now);
+    }
+    publisher_task_ = nullptr;
+    vTaskDelete(nullptr);
 }
 
@@ -0,0 +1,128 @@
+#include "bench.h"
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+static bool s_quick = false;
+static const char *s_filter = nullptr;
+static FILE *s_out = stdout;
+
+// sanitizers bring their own allocator
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+#define COUNT_ALLOCATIONS 1
+#endif
+
+#if COUNT_ALLOCATIONS
+// counted here, the allocator is glibc's - operator new ends up in malloc as well
+static __thread uint64_t t_allocations = 0;
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+    t_allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    t_allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    t_allocations++;
+    return __libc_realloc(ptr, size);
+}
+}
+#endif
+
+namespace bench {
+    void init(int argc, char **argv) {
+        bool verbose = false;
+        for (int i = 1; i < argc; i++) {
+            if (strcmp(argv[i], "--quick") == 0) {
+                s_quick = true;
+            } else if (strcmp(argv[i], "--verbose") == 0) {
+                verbose = true;
+            } else if (strcmp(argv[i], "--help") == 0) {
+                printf("usage: %s [--quick] [--verbose] [name filter]\n", argv[0]);
+                exit(0);
+            } else {
+                s_filter = argv[i];
+            }
+        }
+
+        if (!verbose) {
+            fflush(stdout);
+            int fd = dup(STDOUT_FILENO);
+            int null = open("/dev/null", O_WRONLY);
+            if (fd >= 0 && null >= 0) {
+                dup2(null, STDOUT_FILENO);
+                close(null);
+                s_out = fdopen(fd, "w");
+            }
+        }
+        setvbuf(s_out, nullptr, _IOLBF, 0);
+    }
+
+    bool quick() {
+        return s_quick;
+    }
+
+    bool selected(const char *name) {
+        return !s_filter || strstr(name, s_filter);
+    }
+
+    int64_t min_batch_ns() {
+        return s_quick ? 1000000 : 200000000;
+    }
+
+    uint64_t allocations() {
+#if COUNT_ALLOCATIONS
+        return t_allocations;
+#else
+        return 0;
+#endif
+    }
+
+    bool counts_allocations() {
+#if COUNT_ALLOCATIONS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void report(const char *name, const result_t &result, const char *comment_format, ...) {
+        static bool header = false;
+        if (!header) {
+            fprintf(s_out, "%-56s %12s %10s\n", "benchmark", "ns/op", "allocs/op");
+            header = true;
+        }
+        if (counts_allocations())
+            fprintf(s_out, "%-56s %12.1f %10.2f", name, result.ns_per_op, result.allocs_per_op);
+        else
+            fprintf(s_out, "%-56s %12.1f %10s", name, result.ns_per_op, "-");
+        if (comment_format) {
+            fputs("  ", s_out);
+            va_list args;
+            va_start(args, comment_format);
+            vfprintf(s_out, comment_format, args);
+            va_end(args);
+        }
+        fputc('\n', s_out);
+    }
+
+    void note(const char *format, ...) {
+        va_list args;
+        va_start(args, format);
+        vfprintf(s_out, format, args);
+        va_end(args);
+        fputc('\n', s_out);
+    }
+}
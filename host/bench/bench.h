@@ -0,0 +1,56 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+/*
+ * a minimal benchmark runner - an op is timed in doubling batches until a batch runs long enough
+ * allocations are the calls to malloc, calloc, realloc and operator new made by the timing thread
+ * (glibc only, not under a sanitizer)
+ * results go to the real stdout, the component logs to stdout as well and is sent to /dev/null unless --verbose
+ */
+namespace bench {
+    struct result_t {
+        uint64_t ops;
+        double ns_per_op;
+        double allocs_per_op;
+    };
+
+    // --quick (a smoke run for ctest), --verbose, a single other argument selects benchmarks by substring
+    void init(int argc, char **argv);
+    bool quick();
+    bool selected(const char *name);
+
+    // heap allocations of the calling thread so far, 0 where they can not be counted
+    uint64_t allocations();
+    bool counts_allocations();
+
+    // one line per benchmark - name, ns/op, allocs/op and an optional comment
+    void report(const char *name, const result_t &result, const char *comment_format = nullptr, ...)
+        __attribute__((format(printf, 3, 4)));
+    void note(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+    int64_t min_batch_ns();
+
+    template<typename F>
+    result_t measure(F &&op) {
+        using clock = std::chrono::steady_clock;
+        uint64_t batch = 1;
+        while (true) {
+            uint64_t allocs = allocations();
+            auto start = clock::now();
+            for (uint64_t i = 0; i < batch; i++)
+                op();
+            int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+            allocs = allocations() - allocs;
+            if (ns >= min_batch_ns() || batch >= (1ull << 40))
+                return {batch, (double) ns / batch, (double) allocs / batch};
+            batch *= 2;
+        }
+    }
+
+    // keeps the compiler from dropping a result
+    template<typename T>
+    inline void keep(const T &value) {
+        asm volatile("" : : "g"(&value) : "memory");
+    }
+}
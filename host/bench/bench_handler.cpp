@@ -0,0 +1,169 @@
+#include <apptools/ha_mqtt_handler.h>
+#include <apptools/log_collector.h>
+#include "bench.h"
+#include "fixture.h"
+#include "host_mqtt.h"
+
+// the publish, discovery and command paths of ha_mqtt_handler with 1, 10 and 200 sub devices
+
+/*
+ * the handler without its publisher task and state timer - the benchmark thread runs the paths directly
+ */
+class bench_handler_t : public ha_mqtt_handler {
+public:
+    bench_handler_t(const esp_mqtt_client_config_t *mqtt_config, const device_config_t *config)
+        : ha_mqtt_handler(mqtt_config, config, nullptr) {
+    }
+
+    // what start() sets up, then the broker accepts us
+    void connect() {
+        publisher_config_t publisher;
+        intern_topics();
+        cache_builtin_discovery();
+        discovery_messages_.set_rate(UINT32_MAX);
+        discovery_bytes_.set_rate(UINT32_MAX);
+        gate_.set_client(mqtt_client_);
+        gate_.set_telemetry(&telemetry_);
+        gate_.set_budget(publisher.outbox_budget_bytes);
+        gate_.set_topic_alias_max(publisher.topic_aliases);
+        esp_mqtt_client_start(mqtt_client_);
+        esp_mqtt_client_register_event(mqtt_client_, MQTT_EVENT_ANY, event_handler_wrapper, this);
+        host_mqtt::connect(mqtt_client_);
+    }
+
+    void state(bool force) {
+        force_publish_ = force;
+        auto registry = registry_.read();
+        publish_state(*registry, schedule_dirty_.exchange(false));
+    }
+
+    void discovery() {
+        auto registry = registry_.read();
+        cache_discovery(*registry->sensors[0]);
+    }
+
+    void discovery(size_t sub_device) {
+        auto registry = registry_.read();
+        cache_discovery(registry->sub_devices[sub_device], registry->sub_device_state_topics[sub_device]);
+    }
+
+    // every cached entry out through the gate, unpaced
+    size_t discovery_round() {
+        xSemaphoreTake(discovery_mutex_, portMAX_DELAY);
+        discovery_cache_.invalidate();
+        size_t n = discovery_cache_.pending();
+        xSemaphoreGive(discovery_mutex_);
+        discovery_pending_ = true;
+        pump_discovery(esp_timer_get_time() / 1000);
+        return n;
+    }
+
+    void control(const char *topic, const char *data) {
+        auto registry = registry_.read();
+        handle_control_message(*registry, topic, strlen(topic), data, strlen(data));
+    }
+
+    const char *relay_topic(size_t sub_device) {
+        auto registry = registry_.read();
+        return command_topic(registry->sub_devices[sub_device].get(), "relay");
+    }
+
+    // the benchmark thread stands in for the publisher task, its notifications are drained now and then
+    void adopt_publisher() {
+        publisher_task_ = xTaskGetCurrentTaskHandle();
+    }
+
+    void release_publisher() {
+        ulTaskNotifyTake(pdTRUE, 0);
+        publisher_task_ = nullptr;
+    }
+
+    void timer_callback() {
+        state_timer_wrapper(this);
+    }
+};
+
+static void run(int sub_devices) {
+    char name[96];
+    device_config_t config;
+    esp_mqtt_client_config_t mqtt;
+    fixture::init(config, mqtt, MQTT_PROTOCOL_V_5);
+
+    bench_handler_t handler(&mqtt, &config);
+    handler.enable_logging(&LogCollector::instance());
+    auto relay = std::make_shared<fixture::relay_t>();
+    handler.add_sensor(fixture::climate_sensor(1000, relay));
+    for (int i = 0; i < sub_devices; i++)
+        handler.add_managed_device(fixture::sub_device(i, 1000, relay));
+    handler.connect();
+    handler.state(true);
+
+    snprintf(name, sizeof(name), "publish_state full/%d", sub_devices);
+    if (bench::selected(name)) {
+        auto result = bench::measure([&] { handler.state(true); });
+        bench::report(name, result, "%d state messages", sub_devices + 1);
+    }
+
+    snprintf(name, sizeof(name), "publish_state nothing due/%d", sub_devices);
+    if (bench::selected(name)) {
+        handler.state(true);
+        bench::report(name, bench::measure([&] { handler.state(false); }));
+    }
+
+    // the sensor overload renders the entities of a main device sensor, the device overload those of a sub device
+    snprintf(name, sizeof(name), "cache_discovery(sensor)/%d", sub_devices);
+    if (bench::selected(name)) {
+        bench::report(name, bench::measure([&] { handler.discovery(); }), "3 entities");
+    }
+
+    snprintf(name, sizeof(name), "cache_discovery(device, state_topic)/%d", sub_devices);
+    if (bench::selected(name)) {
+        size_t i = 0;
+        auto result = bench::measure([&] { handler.discovery(i++ % sub_devices); });
+        bench::report(name, result, "3 entities");
+    }
+
+    snprintf(name, sizeof(name), "discovery round/%d", sub_devices);
+    if (bench::selected(name)) {
+        size_t n = 0;
+        auto result = bench::measure([&] { n = handler.discovery_round(); });
+        bench::report(name, result, "%d retained configs", (int) n);
+    }
+
+    snprintf(name, sizeof(name), "handle_control_message/%d", sub_devices);
+    if (bench::selected(name)) {
+        const char *topic = handler.relay_topic(sub_devices / 2);
+        bool on = false;
+        auto result = bench::measure([&] {
+            handler.control(topic, on ? "ON" : "OFF");
+            on = !on;
+        });
+        bench::report(name, result, "%u commands", (unsigned) relay->commands.load());
+    }
+
+    // what the esp_timer task pays per state timer expiry - it ran publish_state before the publisher task
+    snprintf(name, sizeof(name), "state timer callback/%d", sub_devices);
+    if (bench::selected(name)) {
+        handler.adopt_publisher();
+        uint32_t n = 0;
+        auto result = bench::measure([&] {
+            handler.timer_callback();
+            if (++n % 1024 == 0)
+                ulTaskNotifyTake(pdTRUE, 0);
+        });
+        handler.release_publisher();
+        bench::report(name, result, "notify only, compare publish_state full");
+    }
+
+    auto stats = host_mqtt::stats(host_mqtt::last_client());
+    bench::note("  broker saw %llu messages, %llu bytes, %llu sent aliased, %llu alias errors",
+                (unsigned long long) stats.published, (unsigned long long) stats.bytes,
+                (unsigned long long) stats.aliased, (unsigned long long) stats.alias_errors);
+}
+
+int main(int argc, char **argv) {
+    bench::init(argc, argv);
+    for (int sub_devices : {1, 10, 200})
+        run(sub_devices);
+    return 0;
+}
@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <sys/time.h>
+#include <thread>
+#include <vector>
+#include <apptools/log_collector.h>
+#include "bench.h"
+#include "esp_log.h"
+#include "freertos/semphr.h"
+
+// LogCollector::log_vprintf as ESP_LOGx reaches it, against the mutex and double printf collector it replaced
+
+static const char *TAG = "bench";
+
+#define LEGACY_BUFFER_SIZE 4096
+#define PRODUCERS 4
+
+/*
+ * the collector before the ring: one mutex, a strftime prefix per line, the line printed and then formatted again
+ */
+class legacy_collector_t {
+public:
+    legacy_collector_t() : mutex_(xSemaphoreCreateMutex()) {
+    }
+
+    ~legacy_collector_t() {
+        vSemaphoreDelete(mutex_);
+    }
+
+    static int vprintf_wrapper(const char *fmt, va_list args) {
+        return instance().log_vprintf(fmt, args);
+    }
+
+    static legacy_collector_t &instance() {
+        static legacy_collector_t collector;
+        return collector;
+    }
+
+    static void current_time(char *time_str, size_t max_len) {
+        struct timeval tv;
+        struct tm timeinfo;
+        gettimeofday(&tv, NULL);
+        localtime_r(&tv.tv_sec, &timeinfo);
+        strftime(time_str, max_len, "%Y-%m-%d %H:%M:%S", &timeinfo);
+
+        char ms_str[10];
+        snprintf(ms_str, sizeof(ms_str), ".%03d", (int) (tv.tv_usec / 1000));
+        strncat(time_str, ms_str, max_len - strlen(time_str) - 1);
+    }
+
+    int log_vprintf(const char *fmt, va_list args) {
+        va_list args_copy;
+        va_copy(args_copy, args);
+        int stdout_ret = vprintf(fmt, args_copy);
+        va_end(args_copy);
+
+        if (xSemaphoreTake(mutex_, pdMS_TO_TICKS(100)) == pdTRUE) {
+            // nobody sends here, the buffer starts over instead
+            if (pos_ > LEGACY_BUFFER_SIZE - 256)
+                pos_ = 0;
+            char time_str[32];
+            current_time(time_str, sizeof(time_str));
+            pos_ += snprintf(buffer_ + pos_, LEGACY_BUFFER_SIZE - pos_, "%s ", time_str);
+            int ret = vsnprintf(buffer_ + pos_, LEGACY_BUFFER_SIZE - pos_, fmt, args);
+            if (ret > 0)
+                pos_ += std::min<size_t>(ret, LEGACY_BUFFER_SIZE - pos_ - 1);
+            xSemaphoreGive(mutex_);
+        }
+        return stdout_ret;
+    }
+
+private:
+    SemaphoreHandle_t mutex_;
+    char buffer_[LEGACY_BUFFER_SIZE];
+    size_t pos_ = 0;
+};
+
+static void log_line(uint32_t n) {
+    ESP_LOGI(TAG, "sensor %d read %.2f in %u us", (int) (n % 16), 21.5 + (n % 10), (unsigned) (n % 1000));
+}
+
+// the same line from PRODUCERS threads at once, ns per line per producer
+static bench::result_t contended(uint32_t lines) {
+    std::atomic<bool> go{false};
+    std::vector<std::thread> producers;
+    std::atomic<uint64_t> ns{0};
+    for (int p = 0; p < PRODUCERS; p++) {
+        producers.emplace_back([&] {
+            while (!go)
+                std::this_thread::yield();
+            auto start = std::chrono::steady_clock::now();
+            for (uint32_t i = 0; i < lines; i++)
+                log_line(i);
+            ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        });
+    }
+    go = true;
+    for (auto &producer : producers)
+        producer.join();
+    return {lines, (double) ns / PRODUCERS / lines, 0};
+}
+
+int main(int argc, char **argv) {
+    bench::init(argc, argv);
+    LogCollector &collector = LogCollector::instance();
+    std::atomic<uint64_t> sent_bytes{0};
+    collector.set_callback([&sent_bytes](const char *, size_t len) { sent_bytes += len; });
+    uint32_t n = 0;
+
+    struct {
+        const char *name;
+        LogCollector::capture_mode_t mode;
+        LogCollector::timestamp_t timestamp;
+    } modes[] = {
+        {"log line format once, calendar time", LogCollector::capture_mode_t::FORMAT_ONCE, LogCollector::timestamp_t::CALENDAR},
+        {"log line format once, epoch ms", LogCollector::capture_mode_t::FORMAT_ONCE, LogCollector::timestamp_t::EPOCH_MS},
+        {"log line format once, monotonic ms", LogCollector::capture_mode_t::FORMAT_ONCE, LogCollector::timestamp_t::MONOTONIC_MS},
+        {"log line deferred, calendar time", LogCollector::capture_mode_t::DEFERRED, LogCollector::timestamp_t::CALENDAR},
+    };
+    for (const auto &mode : modes) {
+        if (!bench::selected(mode.name))
+            continue;
+        collector.set_capture_mode(mode.mode);
+        collector.set_timestamp(mode.timestamp);
+        bench::report(mode.name, bench::measure([&] { log_line(n++); }));
+    }
+    collector.set_capture_mode(LogCollector::capture_mode_t::FORMAT_ONCE);
+    collector.set_timestamp(LogCollector::timestamp_t::CALENDAR);
+
+    if (bench::selected("timestamp prefix strftime")) {
+        char time_str[32];
+        auto result = bench::measure([&] {
+            legacy_collector_t::current_time(time_str, sizeof(time_str));
+            bench::keep(time_str);
+        });
+        bench::report("timestamp prefix strftime per line", result, "before the cached calendar prefix");
+    }
+
+    // the prefix alone, without the line and the ring
+    struct {
+        const char *name;
+        LogCollector::timestamp_t timestamp;
+    } prefixes[] = {
+        {"timestamp prefix cached calendar", LogCollector::timestamp_t::CALENDAR},
+        {"timestamp prefix epoch ms", LogCollector::timestamp_t::EPOCH_MS},
+        {"timestamp prefix monotonic ms", LogCollector::timestamp_t::MONOTONIC_MS},
+    };
+    for (const auto &prefix : prefixes) {
+        if (!bench::selected(prefix.name))
+            continue;
+        collector.set_timestamp(prefix.timestamp);
+        char time_str[LogCollector::LOG_TIME_MAX];
+        auto result = bench::measure([&] {
+            collector.timestamp_prefix(time_str);
+            bench::keep(time_str);
+        });
+        bench::report(prefix.name, result);
+    }
+    collector.set_timestamp(LogCollector::timestamp_t::CALENDAR);
+
+    uint32_t lines = bench::quick() ? 2000 : 200000;
+    if (bench::selected("4 producers ring")) {
+        auto before = collector.stats();
+        auto result = contended(lines);
+        auto after = collector.stats();
+        bench::report("log line 4 producers, ring", result, "%u captured, %u busy, %u dropped",
+                      (unsigned) (after.captured - before.captured), (unsigned) (after.busy - before.busy),
+                      (unsigned) (after.dropped - before.dropped));
+    }
+
+    // the reference collector in place of the ring
+    auto previous = esp_log_set_vprintf(legacy_collector_t::vprintf_wrapper);
+    if (bench::selected("log line legacy")) {
+        bench::report("log line legacy (mutex, printf twice)", bench::measure([&] { log_line(n++); }));
+    }
+    if (bench::selected("4 producers legacy")) {
+        bench::report("log line 4 producers, legacy", contended(lines));
+    }
+    esp_log_set_vprintf(previous);
+
+    collector.detach_callback();
+    bench::note("  sent %llu bytes of logs", (unsigned long long) sent_bytes.load());
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <apptools/topic_router.h>
+#include "bench.h"
+
+// command dispatch with 500 subscribed topics - the router against the strtok parse and linear device search it replaced
+
+#define TOPICS 500
+#define MAX_TOPIC_LEN 256
+
+static const char *DEVICE_EID = "0b1c2d3e-4f50-4612-8734-a5b6c7d8e9f0";
+
+// huzza32/<eid>/<sub eid>/<key>/set, split like handle_control_message did before the router
+static int legacy_dispatch(const std::vector<std::string> &sub_devices, const char *topic, int topic_len) {
+    static char topic_str[MAX_TOPIC_LEN];
+    int safe_topic_len = std::min(topic_len, (int) sizeof(topic_str) - 1);
+    strncpy(topic_str, topic, safe_topic_len);
+    topic_str[safe_topic_len] = '\0';
+    if (!strstr(topic_str, "/set"))
+        return -1;
+
+    char *topic_parts[5];
+    char *topic_copy = strdup(topic_str);
+    char *token = strtok(topic_copy, "/");
+    int part_count = 0;
+    while (token != nullptr && part_count < 5) {
+        topic_parts[part_count++] = token;
+        token = strtok(nullptr, "/");
+    }
+
+    int found = -1;
+    if (part_count == 5) {
+        for (size_t i = 0; i < sub_devices.size(); i++) {
+            if (strcmp(sub_devices[i].c_str(), topic_parts[2]) == 0) {
+                found = (int) i;
+                break;
+            }
+        }
+    }
+    free(topic_copy);
+    return found;
+}
+
+int main(int argc, char **argv) {
+    bench::init(argc, argv);
+
+    std::vector<std::string> sub_devices;
+    std::vector<std::string> topics;
+    for (int i = 0; i < TOPICS; i++) {
+        char eid[16];
+        snprintf(eid, sizeof(eid), "sub-%04d", i);
+        sub_devices.push_back(eid);
+        topics.push_back(std::string("huzza32/") + DEVICE_EID + "/" + eid + "/relay/set");
+    }
+
+    topic_router router;
+    uint32_t hits = 0;
+    for (const auto &topic : topics)
+        router.add(topic.c_str(), [&hits](const char *, int) { hits++; });
+
+    // every topic in turn, so the search is not always the same path
+    size_t i = 0;
+    if (bench::selected("topic_router dispatch hit")) {
+        auto result = bench::measure([&] {
+            const std::string &topic = topics[i++ % TOPICS];
+            router.dispatch(topic.data(), topic.size(), "ON", 2);
+        });
+        bench::report("topic_router dispatch hit/500", result, "%u dispatched", (unsigned) hits);
+    }
+
+    if (bench::selected("topic_router dispatch miss")) {
+        std::string topic = std::string("huzza32/") + DEVICE_EID + "/sub-9999/relay/set";
+        auto result = bench::measure([&] {
+            bench::keep(router.dispatch(topic.data(), topic.size(), "ON", 2));
+        });
+        bench::report("topic_router dispatch miss/500", result);
+    }
+
+    if (bench::selected("strtok parse")) {
+        int found = 0;
+        auto result = bench::measure([&] {
+            const std::string &topic = topics[i++ % TOPICS];
+            found = legacy_dispatch(sub_devices, topic.data(), topic.size());
+            bench::keep(found);
+        });
+        bench::report("strtok parse + device search/500", result, "before the router");
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include <cstdio>
+#include <apptools/ha_discovery.h>
+#include <apptools/json_writer.h>
+#include "bench.h"
+
+// json_writer against the snprintf chains it replaced, and cbor against json for the same state message
+
+#define PAYLOAD_SIZE 1024
+
+static const char *DEVICE_EID = "0b1c2d3e-4f50-4612-8734-a5b6c7d8e9f0";
+
+// a state message like publish_state() writes for a main device with one climate sensor
+static size_t state_snprintf(char *payload, size_t size, uint32_t n) {
+    int len = snprintf(payload, size, "{\"uptime\":%u", (unsigned) n);
+    len += snprintf(payload + len, size - len, ",\"cpu_load\":%.1f", 12.5 + (n % 10));
+    len += snprintf(payload + len, size - len, ",\"free_memory\":%u", (unsigned) (180000 + n % 1000));
+    len += snprintf(payload + len, size - len, ",\"temperature\":%.1f", 21.0 + (n % 50) * 0.1);
+    len += snprintf(payload + len, size - len, ",\"humidity\":%.1f", 40.0 + (n % 20) * 0.5);
+    len += snprintf(payload + len, size - len, ",\"relay\":\"%s\"", n & 1 ? "ON" : "OFF");
+    len += snprintf(payload + len, size - len, "}");
+    return len;
+}
+
+static size_t state_json_writer(char *payload, size_t size, uint32_t n) {
+    json_writer json(payload, size);
+    json.begin_object()
+        .field("uptime", n)
+        .field("cpu_load", 12.5 + (n % 10), 1)
+        .field("free_memory", 180000 + n % 1000)
+        .field("temperature", 21.0 + (n % 50) * 0.1, 1)
+        .field("humidity", 40.0 + (n % 20) * 0.5, 1)
+        .field("relay", n & 1 ? "ON" : "OFF")
+        .end_object();
+    return json.length();
+}
+
+static size_t state_payload_writer(char *payload, size_t size, uint32_t n, ha_discovery::state_encoding_t encoding) {
+    ha_discovery::payload_writer_t writer(payload, size, encoding);
+    writer.add("uptime", n);
+    writer.add("cpu_load", 12.5 + (n % 10), 1);
+    writer.add("free_memory", 180000 + n % 1000);
+    writer.add("temperature", 21.0 + (n % 50) * 0.1, 1);
+    writer.add("humidity", 40.0 + (n % 20) * 0.5, 1);
+    writer.add("relay", n & 1 ? "ON" : "OFF");
+    return writer.finish();
+}
+
+// the string heavy part of a discovery config
+static size_t discovery_snprintf(char *payload, size_t size) {
+    int len = snprintf(payload, size, "{\"name\":\"%s\",\"unique_id\":\"%s_%s\",\"state_topic\":\"huzza32/%s/state\"",
+                       "Temperature", DEVICE_EID, "temperature", DEVICE_EID);
+    len += snprintf(payload + len, size - len, ",\"value_template\":\"{{ value_json.%s }}\"", "temperature");
+    len += snprintf(payload + len, size - len, ",\"unit_of_measurement\":\"%s\",\"device_class\":\"%s\"",
+                    "°C", "temperature");
+    len += snprintf(payload + len, size - len, ",\"expire_after\":%d", 30);
+    len += snprintf(payload + len, size - len,
+                    ",\"device\":{\"identifiers\":[\"%s\"],\"name\":\"%s\",\"model\":\"%s\",\"manufacturer\":\"%s\","
+                    "\"sw_version\":\"%s\"}}", DEVICE_EID, "bench", "bench", "host", "1.0.0");
+    return len;
+}
+
+static size_t discovery_json_writer(char *payload, size_t size) {
+    json_writer json(payload, size);
+    json.begin_object().field("name", "Temperature");
+    json.string_begin("unique_id").string_append(DEVICE_EID).string_append("_").string_append("temperature").string_end();
+    json.string_begin("state_topic").string_append("huzza32/").string_append(DEVICE_EID).string_append("/state").string_end();
+    json.string_begin("value_template").string_append("{{ value_json.").string_append("temperature").string_append(" }}")
+        .string_end();
+    json.field("unit_of_measurement", "°C").field("device_class", "temperature").field("expire_after", 30);
+    json.begin_object("device").begin_array("identifiers").value(DEVICE_EID).end_array()
+        .field("name", "bench").field("model", "bench").field("manufacturer", "host").field("sw_version", "1.0.0")
+        .end_object();
+    json.end_object();
+    return json.length();
+}
+
+int main(int argc, char **argv) {
+    bench::init(argc, argv);
+    char payload[PAYLOAD_SIZE];
+    size_t len = 0;
+    uint32_t n = 0;
+
+    struct {
+        const char *name;
+        size_t (*write)(char *, size_t, uint32_t);
+    } states[] = {
+        {"state message snprintf", state_snprintf},
+        {"state message json_writer", state_json_writer},
+    };
+    for (const auto &state : states) {
+        if (!bench::selected(state.name))
+            continue;
+        auto result = bench::measure([&] {
+            len = state.write(payload, sizeof(payload), n++);
+            bench::keep(payload);
+        });
+        bench::report(state.name, result, "%d bytes, %.0f bytes/us", (int) len, len * 1000.0 / result.ns_per_op);
+    }
+
+    struct {
+        const char *name;
+        size_t (*write)(char *, size_t);
+    } discoveries[] = {
+        {"discovery config snprintf", discovery_snprintf},
+        {"discovery config json_writer", discovery_json_writer},
+    };
+    for (const auto &discovery : discoveries) {
+        if (!bench::selected(discovery.name))
+            continue;
+        auto result = bench::measure([&] {
+            len = discovery.write(payload, sizeof(payload));
+            bench::keep(payload);
+        });
+        bench::report(discovery.name, result, "%d bytes, %.0f bytes/us", (int) len, len * 1000.0 / result.ns_per_op);
+    }
+
+    struct {
+        const char *name;
+        ha_discovery::state_encoding_t encoding;
+    } encodings[] = {
+        {"payload_writer_t json", ha_discovery::state_encoding_t::JSON},
+        {"payload_writer_t cbor", ha_discovery::state_encoding_t::CBOR},
+    };
+    for (const auto &encoding : encodings) {
+        if (!bench::selected(encoding.name))
+            continue;
+        auto result = bench::measure([&] {
+            len = state_payload_writer(payload, sizeof(payload), n++, encoding.encoding);
+            bench::keep(payload);
+        });
+        bench::report(encoding.name, result, "%d bytes", (int) len);
+    }
+    return 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <apptools/device_config.h>
+#include <apptools/ha_discovery.h>
+#include <apptools/mqtt_utils.h>
+#include "esp_timer.h"
+
+// the device the benchmarks and the loopback harness publish - n sub devices with a climate sensor and a relay each
+
+namespace fixture {
+    inline void init(device_config_t &config, esp_mqtt_client_config_t &mqtt, esp_mqtt_protocol_ver_t protocol) {
+        snprintf(config.manufacturer, sizeof(config.manufacturer), "%s", "host");
+        snprintf(config.model, sizeof(config.model), "%s", "bench");
+        snprintf(config.eid, sizeof(config.eid), "%s", "0b1c2d3e-4f50-4612-8734-a5b6c7d8e9f0");
+        snprintf(config.hardware_revision, sizeof(config.hardware_revision), "%s", "1");
+        snprintf(config.software_revision, sizeof(config.software_revision), "%s", "1.0.0");
+        mqtt_init_default(&mqtt, "mqtt://127.0.0.1", 1883, protocol);
+    }
+
+    // temperature and humidity move on every poll, the relay follows its /set topic
+    struct relay_t {
+        std::atomic<bool> on{false};
+        std::atomic<uint32_t> commands{0};
+        std::atomic<int64_t> last_command_us{0};
+    };
+
+    inline std::shared_ptr<ha_discovery::sensor_wrapper_t> climate_sensor(uint32_t interval_ms,
+                                                                          std::shared_ptr<relay_t> relay) {
+        auto tick = std::make_shared<uint32_t>(0);
+        auto sensor = std::make_shared<ha_discovery::sensor_wrapper_t>(
+            interval_ms,
+            [] {
+                return std::vector<ha_discovery::control_config_t>{
+                    ha_discovery::control_config_t::make_sensor("Temperature", "temperature", "°C", "temperature"),
+                    ha_discovery::control_config_t::make_sensor("Humidity", "humidity", "%", "humidity"),
+                    ha_discovery::control_config_t::make_switch("Relay", "relay"),
+                };
+            },
+            [tick, relay](ha_discovery::payload_writer_t &writer) {
+                uint32_t n = (*tick)++;
+                writer.add("temperature", 21.0 + (n % 50) * 0.1, 1);
+                writer.add("humidity", 40.0 + (n % 20) * 0.5, 1);
+                writer.add("relay", relay->on ? "ON" : "OFF");
+            });
+        sensor->on_command("relay", [relay](const char *data, int data_len) {
+            relay->on = data_len == 2 && strncmp(data, "ON", 2) == 0;
+            relay->last_command_us = esp_timer_get_time();
+            relay->commands++;
+        });
+        return sensor;
+    }
+
+    inline std::shared_ptr<ha_discovery::device_info_t> sub_device(int index, uint32_t interval_ms,
+                                                                   std::shared_ptr<relay_t> relay) {
+        char eid[ha_discovery::MAX_EID_LENGTH];
+        char name[ha_discovery::MAX_NAME_LENGTH];
+        snprintf(eid, sizeof(eid), "sub-%04d", index);
+        snprintf(name, sizeof(name), "Sub device %d", index);
+        auto device = ha_discovery::device_info_t::make_shared(eid, name, "bench-sub", "1", "1.0.0",
+            "0000000000000000000000000000000000000000000000000000000000000000");
+        device->add_sensor(climate_sensor(interval_ms, relay));
+        return device;
+    }
+}
@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <apptools/ha_mqtt_handler.h>
+#include <apptools/log_collector.h>
+#include "bench.h"
+#include "fixture.h"
+#include "host_mqtt.h"
+
+/*
+ * the handler with its publisher task, state timer and log collector against a broker stand-in
+ * the broker is the in-process esp-mqtt stub (host_mqtt.h), not a socket - what is measured is the handler,
+ * the gate and the client lock, without network latency
+ * this thread plays the mqtt task: connects, delivers commands and restarts the broker
+ */
+
+#define STATE_INTERVAL_MS 100 // the fastest the publisher polls a sensor
+#define SLOW_INTERVAL_MS 60000 // longer than HA's default expire_after
+#define SLOW_EID "slow"
+
+struct options_t {
+    esp_mqtt_protocol_ver_t protocol;
+    int sub_devices;
+    uint32_t discovery_messages_per_s;
+    uint32_t discovery_bytes_per_s;
+    int sustained_ms;
+    int commands;
+    int restart_pause_ms;
+    int timeout_ms;
+};
+
+/*
+ * what arrives at the broker, receive() runs on the publishing thread under the client lock
+ * the counters are guarded by mutex, wait() predicates run with it held
+ */
+struct broker_t {
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint64_t discovery = 0;
+    uint64_t state = 0;
+    uint64_t state_bytes = 0;
+    uint64_t state_wire_bytes = 0;
+    uint64_t logs = 0;
+    int64_t last_discovery_us = 0;
+    std::set<std::string> state_topics;
+    // the first state message on watch_topic that contains watch_text
+    std::string watch_topic;
+    std::string watch_text;
+    int64_t watch_hit_us = 0;
+    // the 60 s sensor - its expire_after and when its state arrived
+    uint32_t slow_expire_after_s = 0;
+    std::vector<int64_t> slow_states_us;
+
+    void receive(const host_mqtt::message_t &message) {
+        int64_t now = esp_timer_get_time();
+        std::string topic(message.topic, message.topic_len);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (topic.compare(0, 14, "homeassistant/") == 0) {
+            discovery++;
+            last_discovery_us = now;
+            if (topic.find("/" SLOW_EID "_") != std::string::npos) {
+                std::string payload(message.data, message.len);
+                size_t at = payload.find("\"expire_after\":");
+                if (at != std::string::npos)
+                    slow_expire_after_s = strtoul(payload.c_str() + at + 15, nullptr, 10);
+            }
+        } else if (ends_with(topic, "/state") || ends_with(topic, "/state/cbor")) {
+            state++;
+            state_bytes += message.len;
+            state_wire_bytes += message.wire_len;
+            state_topics.insert(topic);
+            if (ends_with(topic, "/" SLOW_EID "/state"))
+                slow_states_us.push_back(now);
+            const char *end = message.data + message.len;
+            if (!watch_hit_us && topic == watch_topic &&
+                std::search(message.data, end, watch_text.begin(), watch_text.end()) != end) {
+                watch_hit_us = now;
+            }
+        } else if (ends_with(topic, "/logs")) {
+            logs++;
+        }
+        cv.notify_all();
+    }
+
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        discovery = 0;
+        state = 0;
+        state_bytes = 0;
+        state_wire_bytes = 0;
+        logs = 0;
+        state_topics.clear();
+    }
+
+    void watch(const std::string &topic, const std::string &text) {
+        std::lock_guard<std::mutex> lock(mutex);
+        watch_topic = topic;
+        watch_text = text;
+        watch_hit_us = 0;
+    }
+
+    // false on timeout
+    bool wait(int timeout_ms, const std::function<bool()> &done) {
+        std::unique_lock<std::mutex> lock(mutex);
+        return cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), done);
+    }
+
+    static bool ends_with(const std::string &s, const char *suffix) {
+        size_t n = strlen(suffix);
+        return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+    }
+};
+
+// one sensor polled every SLOW_INTERVAL_MS on a sub device of its own
+static std::shared_ptr<ha_discovery::device_info_t> slow_device() {
+    auto device = ha_discovery::device_info_t::make_shared(SLOW_EID, "Slow device", "bench-sub", "1", "1.0.0",
+        "0000000000000000000000000000000000000000000000000000000000000000");
+    auto tick = std::make_shared<uint32_t>(0);
+    device->add_sensor(std::make_shared<ha_discovery::sensor_wrapper_t>(
+        SLOW_INTERVAL_MS,
+        [] {
+            return std::vector<ha_discovery::control_config_t>{
+                ha_discovery::control_config_t::make_sensor("Level", "level", "%"),
+            };
+        },
+        [tick](ha_discovery::payload_writer_t &writer) { writer.add("level", (int) ((*tick)++ % 100)); }));
+    return device;
+}
+
+// the handler's own topic for a sub device, found among what it subscribed
+static std::string subscribed(esp_mqtt_client_handle_t client, const std::string &suffix) {
+    for (const auto &topic : host_mqtt::subscriptions(client)) {
+        if (topic.size() >= suffix.size() && topic.compare(topic.size() - suffix.size(), suffix.size(), suffix) == 0)
+            return topic;
+    }
+    return std::string();
+}
+
+static int run(const options_t &options) {
+    device_config_t config;
+    esp_mqtt_client_config_t mqtt;
+    fixture::init(config, mqtt, options.protocol);
+
+    ha_mqtt_handler handler(&mqtt, &config, nullptr);
+    esp_mqtt_client_handle_t client = host_mqtt::last_client();
+    broker_t broker;
+    host_mqtt::set_sink(client, [&broker](const host_mqtt::message_t &message) { broker.receive(message); });
+
+    handler.enable_logging(&LogCollector::instance());
+    std::vector<std::shared_ptr<fixture::relay_t>> relays;
+    relays.push_back(std::make_shared<fixture::relay_t>());
+    handler.add_sensor(fixture::climate_sensor(STATE_INTERVAL_MS, relays[0]));
+    for (int i = 0; i < options.sub_devices; i++) {
+        relays.push_back(std::make_shared<fixture::relay_t>());
+        handler.add_managed_device(fixture::sub_device(i, STATE_INTERVAL_MS, relays.back()));
+    }
+    handler.add_managed_device(slow_device());
+    size_t devices = options.sub_devices + 2;
+
+    publisher_config_t publisher;
+    publisher.discovery_messages_per_s = options.discovery_messages_per_s;
+    publisher.discovery_bytes_per_s = options.discovery_bytes_per_s;
+    handler.start(publisher);
+
+    // discovery burst - from the connect until the last retained config reached the broker
+    int64_t start = esp_timer_get_time();
+    if (!host_mqtt::connect(client)) {
+        bench::note("broker refused the connect");
+        return 1;
+    }
+    size_t configs = handler.discovery_progress().total;
+    int64_t last_discovery_us = 0;
+    bool ok = broker.wait(options.timeout_ms, [&] {
+        last_discovery_us = broker.last_discovery_us;
+        return broker.discovery >= configs && broker.state_topics.size() >= devices;
+    });
+    if (!ok) {
+        bench::note("discovery burst: timed out, %d of %d configs", (int) handler.discovery_progress().sent,
+                    (int) configs);
+        return 1;
+    }
+    bench::note("discovery burst: %d configs in %.0f ms at %u msg/s, %u bytes/s (%s)", (int) configs,
+                (last_discovery_us - start) / 1000.0, (unsigned) options.discovery_messages_per_s,
+                (unsigned) options.discovery_bytes_per_s,
+                host_mqtt::protocol(client) == MQTT_PROTOCOL_V_5 ? "mqtt 5" : "mqtt 3.1.1");
+
+    // sustained state - every sensor polled every STATE_INTERVAL_MS, values change on every poll
+    broker.reset();
+    start = esp_timer_get_time();
+    std::this_thread::sleep_for(std::chrono::milliseconds(options.sustained_ms));
+    uint64_t states = 0;
+    uint64_t state_bytes = 0;
+    uint64_t state_wire_bytes = 0;
+    broker.wait(0, [&] {
+        states = broker.state;
+        state_bytes = broker.state_bytes;
+        state_wire_bytes = broker.state_wire_bytes;
+        return true;
+    });
+    double seconds = (esp_timer_get_time() - start) / 1e6;
+    size_t fast = devices - 1;
+    bench::note("sustained state: %.0f messages/s, %d devices polled every %d ms - %.0f/s asked for",
+                states / seconds, (int) fast, STATE_INTERVAL_MS, fast * 1000.0 / STATE_INTERVAL_MS);
+    // the topic goes out once per connection and alias with mqtt 5, with every message with 3.1.1
+    if (states > 0) {
+        bench::note("state on the wire: %.1f bytes per message, %.1f of them payload", (double) state_wire_bytes / states,
+                    (double) state_bytes / states);
+    }
+
+    /*
+     * command round trip - /set delivered to the relay, until a state message carries the new value
+     * the relay is read on the next poll, the commands are spread over the interval so they do not all land
+     * just ahead of the sweep that published the previous one
+     */
+    std::vector<double> round_trips;
+    for (int i = 0; i < options.commands; i++) {
+        int sub = (i * 37) % options.sub_devices;
+        std::this_thread::sleep_for(std::chrono::milliseconds((i * 37) % STATE_INTERVAL_MS));
+        char eid[16];
+        snprintf(eid, sizeof(eid), "sub-%04d", sub);
+        std::string set_topic = subscribed(client, std::string("/") + eid + "/relay/set");
+        std::string state_topic = set_topic.substr(0, set_topic.size() - strlen("relay/set")) + "state";
+        bool on = !relays[sub + 1]->on;
+        broker.watch(state_topic, on ? "\"relay\":\"ON\"" : "\"relay\":\"OFF\"");
+
+        start = esp_timer_get_time();
+        host_mqtt::deliver(client, set_topic.c_str(), on ? "ON" : "OFF", on ? 2 : 3);
+        int64_t hit_us = 0;
+        if (!broker.wait(options.timeout_ms, [&] { return (hit_us = broker.watch_hit_us) != 0; })) {
+            bench::note("command round trip: timed out on %s", set_topic.c_str());
+            return 1;
+        }
+        round_trips.push_back((hit_us - start) / 1000.0);
+    }
+    std::sort(round_trips.begin(), round_trips.end());
+    bench::note("command round trip: %d commands, min %.1f ms, median %.1f ms, max %.1f ms", (int) round_trips.size(),
+                round_trips.front(), round_trips[round_trips.size() / 2], round_trips.back());
+
+    // broker restart - gone for a while, then a full state from every device
+    host_mqtt::disconnect(client);
+    std::this_thread::sleep_for(std::chrono::milliseconds(options.restart_pause_ms));
+    broker.reset();
+    start = esp_timer_get_time();
+    host_mqtt::connect(client);
+    size_t seen = 0;
+    uint64_t resent = 0;
+    int64_t done_us = 0;
+    bool restarted = broker.wait(options.timeout_ms, [&] {
+        seen = broker.state_topics.size();
+        resent = broker.discovery;
+        done_us = esp_timer_get_time();
+        return seen >= devices;
+    });
+    if (!restarted) {
+        bench::note("broker restart: timed out, state from %d of %d devices", (int) seen, (int) devices);
+        return 1;
+    }
+    bench::note("broker restart: state from all %d devices %.0f ms after the reconnect, %d configs resent",
+                (int) devices, (done_us - start) / 1000.0, (int) resent);
+
+    /*
+     * the slow sensor - HA has to keep it available from one poll to the next
+     * the full run outlasts SLOW_INTERVAL_MS and sees a gap between two polls, --quick only the discovery
+     */
+    uint32_t expire_after_s = 0;
+    int64_t longest_gap_us = 0;
+    broker.wait(0, [&] {
+        expire_after_s = broker.slow_expire_after_s;
+        for (size_t i = 1; i < broker.slow_states_us.size(); i++)
+            longest_gap_us = std::max(longest_gap_us, broker.slow_states_us[i] - broker.slow_states_us[i - 1]);
+        return true;
+    });
+    bench::note("slow sensor: polled every %d ms, expire_after %u s, longest gap between states %.0f ms",
+                SLOW_INTERVAL_MS, (unsigned) expire_after_s, longest_gap_us / 1000.0);
+    if ((uint64_t) expire_after_s * 1000 <= SLOW_INTERVAL_MS || longest_gap_us >= (int64_t) expire_after_s * 1000000) {
+        bench::note("slow sensor: HA would expire it between two polls");
+        return 1;
+    }
+
+    auto stats = host_mqtt::stats(client);
+    auto gate = handler.publish_stats();
+    bench::note("broker: %llu messages, %llu wire bytes, %llu sent aliased, %llu alias errors, %llu refused while away; "
+                "gate: %u coalesced, %u log chunks dropped",
+                (unsigned long long) stats.published, (unsigned long long) stats.wire_bytes,
+                (unsigned long long) stats.aliased,
+                (unsigned long long) stats.alias_errors, (unsigned long long) stats.refused,
+                (unsigned) gate.coalesced, (unsigned) gate.dropped);
+    return stats.alias_errors == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    bench::init(argc, argv);
+    options_t options;
+    if (bench::quick()) {
+        options = {MQTT_PROTOCOL_V_5, 10, 1000, 1000000, 1000, 10, 200, 10000};
+    } else {
+        // the device defaults - pacing as publisher_config_t has it
+        publisher_config_t publisher;
+        options = {MQTT_PROTOCOL_V_5, 200, publisher.discovery_messages_per_s, publisher.discovery_bytes_per_s, 5000,
+                   50, 2000, 180000};
+    }
+    bench::note("mqtt 5 with topic aliases");
+    int result = run(options);
+    // the same against the protocol without aliases, for the bytes per state message
+    options.protocol = MQTT_PROTOCOL_V_3_1_1;
+    bench::note("mqtt 3.1.1");
+    return run(options) | result;
+}
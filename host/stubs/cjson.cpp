@@ -0,0 +1,203 @@
+#include "cJSON.h"
+#include <cstdlib>
+#include <cstring>
+
+// enough of a json parser for add_raw and the tests that feed it, strings are taken as they are except for
+// the simple escapes - \u sequences are kept verbatim
+
+namespace {
+    thread_local const char *t_error = nullptr;
+
+    struct parser_t {
+        const char *p;
+        const char *end;
+
+        void skip() {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+                p++;
+        }
+
+        bool literal(const char *word) {
+            size_t n = strlen(word);
+            if ((size_t) (end - p) < n || strncmp(p, word, n) != 0)
+                return false;
+            p += n;
+            return true;
+        }
+
+        char *string() {
+            // p is at the opening quote
+            const char *start = ++p;
+            size_t len = 0;
+            while (p < end && *p != '"') {
+                if (*p == '\\' && p + 1 < end)
+                    p++;
+                p++;
+                len++;
+            }
+            if (p >= end)
+                return nullptr;
+            char *out = (char *) malloc(len + 1);
+            char *o = out;
+            for (const char *s = start; s < p; s++) {
+                if (*s != '\\') {
+                    *o++ = *s;
+                    continue;
+                }
+                s++;
+                switch (*s) {
+                    case 'n': *o++ = '\n'; break;
+                    case 't': *o++ = '\t'; break;
+                    case 'r': *o++ = '\r'; break;
+                    case 'b': *o++ = '\b'; break;
+                    case 'f': *o++ = '\f'; break;
+                    default: *o++ = *s; break;
+                }
+            }
+            *o = '\0';
+            p++;
+            return out;
+        }
+
+        cJSON *value() {
+            skip();
+            if (p >= end)
+                return nullptr;
+            auto item = (cJSON *) calloc(1, sizeof(cJSON));
+            if (*p == '{' || *p == '[') {
+                bool object = *p == '{';
+                char close = object ? '}' : ']';
+                item->type = object ? cJSON_Object : cJSON_Array;
+                p++;
+                skip();
+                if (p < end && *p == close) {
+                    p++;
+                    return item;
+                }
+                cJSON *last = nullptr;
+                while (true) {
+                    char *name = nullptr;
+                    if (object) {
+                        skip();
+                        if (p >= end || *p != '"' || !(name = string()))
+                            return fail(item);
+                        skip();
+                        if (p >= end || *p++ != ':') {
+                            free(name);
+                            return fail(item);
+                        }
+                    }
+                    cJSON *child = value();
+                    if (!child) {
+                        free(name);
+                        return fail(item);
+                    }
+                    child->string = name;
+                    if (last) {
+                        last->next = child;
+                        child->prev = last;
+                    } else {
+                        item->child = child;
+                    }
+                    last = child;
+                    skip();
+                    if (p < end && *p == ',') {
+                        p++;
+                        continue;
+                    }
+                    if (p < end && *p == close) {
+                        p++;
+                        return item;
+                    }
+                    return fail(item);
+                }
+            }
+            if (*p == '"') {
+                item->type = cJSON_String;
+                item->valuestring = string();
+                return item->valuestring ? item : fail(item);
+            }
+            if (literal("true")) {
+                item->type = cJSON_True;
+                return item;
+            }
+            if (literal("false")) {
+                item->type = cJSON_False;
+                return item;
+            }
+            if (literal("null")) {
+                item->type = cJSON_NULL;
+                return item;
+            }
+            char *number_end = nullptr;
+            double number = strtod(p, &number_end);
+            if (number_end == p || number_end > end)
+                return fail(item);
+            p = number_end;
+            item->type = cJSON_Number;
+            item->valuedouble = number;
+            item->valueint = (int) number;
+            return item;
+        }
+
+        cJSON *fail(cJSON *item) {
+            t_error = p;
+            cJSON_Delete(item);
+            return nullptr;
+        }
+    };
+}
+
+extern "C" {
+
+cJSON *cJSON_ParseWithLength(const char *value, size_t buffer_length) {
+    if (!value)
+        return nullptr;
+    t_error = nullptr;
+    parser_t parser{value, value + buffer_length};
+    cJSON *item = parser.value();
+    parser.skip();
+    if (item && parser.p < parser.end && *parser.p != '\0')
+        return parser.fail(item);
+    return item;
+}
+
+cJSON *cJSON_Parse(const char *value) {
+    return value ? cJSON_ParseWithLength(value, strlen(value)) : nullptr;
+}
+
+void cJSON_Delete(cJSON *item) {
+    while (item) {
+        cJSON *next = item->next;
+        cJSON_Delete(item->child);
+        free(item->valuestring);
+        free(item->string);
+        free(item);
+        item = next;
+    }
+}
+
+const char *cJSON_GetErrorPtr(void) {
+    return t_error;
+}
+
+cJSON *cJSON_GetObjectItem(const cJSON *object, const char *string) {
+    if (!object || !string)
+        return nullptr;
+    for (cJSON *child = object->child; child; child = child->next) {
+        if (child->string && strcmp(child->string, string) == 0)
+            return child;
+    }
+    return nullptr;
+}
+
+int cJSON_IsNumber(const cJSON *item) { return item && item->type == cJSON_Number; }
+int cJSON_IsString(const cJSON *item) { return item && item->type == cJSON_String; }
+int cJSON_IsBool(const cJSON *item) { return item && (item->type == cJSON_True || item->type == cJSON_False); }
+int cJSON_IsTrue(const cJSON *item) { return item && item->type == cJSON_True; }
+int cJSON_IsFalse(const cJSON *item) { return item && item->type == cJSON_False; }
+int cJSON_IsNull(const cJSON *item) { return item && item->type == cJSON_NULL; }
+int cJSON_IsObject(const cJSON *item) { return item && item->type == cJSON_Object; }
+int cJSON_IsArray(const cJSON *item) { return item && item->type == cJSON_Array; }
+
+}
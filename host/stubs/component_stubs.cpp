@@ -0,0 +1,17 @@
+#include <apptools/ha_discovery.h>
+#include <apptools/ota_handler.h>
+#include <apptools/system_stats.h>
+#include "esp_log.h"
+
+// the parts of the component that are all esp-idf (system_stats.cpp, ota_handler.cpp) - not built on the host
+
+static const char *TAG = "host";
+
+cpu_usage_t get_cpu_load() {
+    return {0.0f, 0.0f, 0.0f};
+}
+
+bool ota_handler::handle_subdevice_ota(const ha_discovery::device_info_t *device, const char *) {
+    ESP_LOGW(TAG, "No OTA on the host - ignored for %s", device->eid());
+    return false;
+}
@@ -0,0 +1,67 @@
+#include "esp_log.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace {
+    // constant initialized - the log collector registers itself from a static constructor
+    std::atomic<vprintf_like_t> s_vprintf{vprintf};
+    std::atomic<int> s_level{ESP_LOG_INFO};
+
+    std::mutex &tag_mutex() {
+        static std::mutex *mutex = new std::mutex();
+        return *mutex;
+    }
+
+    std::map<std::string, esp_log_level_t> &tag_levels() {
+        static auto *levels = new std::map<std::string, esp_log_level_t>();
+        return *levels;
+    }
+
+    std::atomic<bool> s_tag_levels{false};
+
+    esp_log_level_t level_for(const char *tag) {
+        if (s_tag_levels.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(tag_mutex());
+            auto it = tag_levels().find(tag);
+            if (it != tag_levels().end())
+                return it->second;
+        }
+        return (esp_log_level_t) s_level.load(std::memory_order_relaxed);
+    }
+}
+
+extern "C" {
+
+vprintf_like_t esp_log_set_vprintf(vprintf_like_t func) {
+    return s_vprintf.exchange(func);
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+    if (strcmp(tag, "*") == 0) {
+        s_level = level;
+        return;
+    }
+    std::lock_guard<std::mutex> lock(tag_mutex());
+    tag_levels()[tag] = level;
+    s_tag_levels = true;
+}
+
+uint32_t esp_log_timestamp(void) {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return (uint32_t) std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+    if (level > level_for(tag))
+        return;
+    va_list args;
+    va_start(args, format);
+    s_vprintf.load()(format, args);
+    va_end(args);
+}
+
+}
@@ -0,0 +1,49 @@
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_system.h"
+#include <cstdio>
+#include <cstdlib>
+
+// a device with plenty of free heap - the governor sees no memory pressure on the host
+
+#define HOST_FREE_HEAP (200 * 1024)
+
+extern "C" {
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        default: return "UNKNOWN ERROR";
+    }
+}
+
+uint32_t esp_get_free_heap_size(void) {
+    return HOST_FREE_HEAP;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void) {
+    return HOST_FREE_HEAP;
+}
+
+void esp_restart(void) {
+    fprintf(stderr, "esp_restart() called\n");
+    abort();
+}
+
+size_t heap_caps_get_free_size(uint32_t) {
+    return HOST_FREE_HEAP;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t) {
+    return HOST_FREE_HEAP;
+}
+
+}
@@ -0,0 +1,125 @@
+#include "esp_timer.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void *arg;
+    int64_t deadline_us; // -1 while stopped
+    uint64_t period_us; // 0 for one shot timers
+};
+
+namespace {
+    // one thread runs every callback in deadline order, like the esp_timer task
+    // never destroyed, timers are still stopped from static destructors at exit
+    struct timer_thread_t {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<esp_timer *> timers;
+
+        timer_thread_t() {
+            std::thread([this] { run(); }).detach();
+        }
+
+        void run() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                esp_timer *next = nullptr;
+                for (auto timer : timers) {
+                    if (timer->deadline_us >= 0 && (!next || timer->deadline_us < next->deadline_us))
+                        next = timer;
+                }
+                if (!next) {
+                    cv.wait(lock);
+                    continue;
+                }
+                int64_t now = esp_timer_get_time();
+                if (next->deadline_us > now) {
+                    cv.wait_for(lock, std::chrono::microseconds(next->deadline_us - now));
+                    continue;
+                }
+
+                // a callback may start, stop or delete timers - its own included
+                esp_timer_cb_t callback = next->callback;
+                void *arg = next->arg;
+                next->deadline_us = next->period_us > 0 ? next->deadline_us + next->period_us : -1;
+                lock.unlock();
+                callback(arg);
+                lock.lock();
+            }
+        }
+    };
+
+    timer_thread_t &timer_thread() {
+        static timer_thread_t *thread = new timer_thread_t();
+        return *thread;
+    }
+
+    esp_err_t arm(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us) {
+        auto &thread = timer_thread();
+        std::lock_guard<std::mutex> lock(thread.mutex);
+        if (timer->deadline_us >= 0)
+            return ESP_ERR_INVALID_STATE;
+        timer->deadline_us = esp_timer_get_time() + timeout_us;
+        timer->period_us = period_us;
+        thread.cv.notify_one();
+        return ESP_OK;
+    }
+}
+
+extern "C" {
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle) {
+    if (!create_args || !create_args->callback || !out_handle)
+        return ESP_ERR_INVALID_ARG;
+    auto timer = new esp_timer{create_args->callback, create_args->arg, -1, 0};
+    auto &thread = timer_thread();
+    std::lock_guard<std::mutex> lock(thread.mutex);
+    thread.timers.push_back(timer);
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    return arm(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period) {
+    return arm(timer, period, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    auto &thread = timer_thread();
+    std::lock_guard<std::mutex> lock(thread.mutex);
+    if (timer->deadline_us < 0)
+        return ESP_ERR_INVALID_STATE;
+    timer->deadline_us = -1;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    auto &thread = timer_thread();
+    std::lock_guard<std::mutex> lock(thread.mutex);
+    if (timer->deadline_us >= 0)
+        return ESP_ERR_INVALID_STATE;
+    thread.timers.erase(std::remove(thread.timers.begin(), thread.timers.end(), timer), thread.timers.end());
+    delete timer;
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer) {
+    auto &thread = timer_thread();
+    std::lock_guard<std::mutex> lock(thread.mutex);
+    return timer->deadline_us >= 0;
+}
+
+int64_t esp_timer_get_time(void) {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+}
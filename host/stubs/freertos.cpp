@@ -0,0 +1,182 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// tasks are threads, mutexes and notifications sit on std::mutex - enough for the component, not a scheduler
+
+// owner and depth, a second take of a plain mutex by its holder deadlocks like on FreeRTOS
+struct QueueDefinition {
+    bool recursive;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread::id owner;
+    uint32_t depth = 0;
+};
+
+struct tskTaskControlBlock {
+    std::string name;
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint32_t notified = 0;
+};
+
+namespace {
+    // thrown by vTaskDelete(nullptr), unwinds to the thread entry
+    struct task_exit_t {};
+
+    struct task_start_t {
+        TaskFunction_t task;
+        void *arg;
+        TaskHandle_t handle;
+    };
+
+    thread_local TaskHandle_t t_current = nullptr;
+
+    BaseType_t take(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait) {
+        std::unique_lock<std::mutex> lock(semaphore->mutex);
+        auto self = std::this_thread::get_id();
+        if (semaphore->recursive && semaphore->depth > 0 && semaphore->owner == self) {
+            semaphore->depth++;
+            return pdTRUE;
+        }
+        auto free = [semaphore] { return semaphore->depth == 0; };
+        if (ticks_to_wait == portMAX_DELAY)
+            semaphore->cv.wait(lock, free);
+        else if (!semaphore->cv.wait_for(lock, std::chrono::milliseconds(ticks_to_wait * portTICK_PERIOD_MS), free))
+            return pdFALSE;
+        semaphore->owner = self;
+        semaphore->depth = 1;
+        return pdTRUE;
+    }
+
+    // like FreeRTOS only the holder gives a mutex back
+    BaseType_t give(SemaphoreHandle_t semaphore) {
+        std::unique_lock<std::mutex> lock(semaphore->mutex);
+        if (semaphore->depth == 0 || semaphore->owner != std::this_thread::get_id())
+            return pdFALSE;
+        if (--semaphore->depth > 0)
+            return pdTRUE;
+        lock.unlock();
+        semaphore->cv.notify_one();
+        return pdTRUE;
+    }
+
+    void task_entry(task_start_t start) {
+        t_current = start.handle;
+        try {
+            start.task(start.arg);
+        } catch (const task_exit_t &) {
+        }
+    }
+}
+
+extern "C" {
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    auto semaphore = new QueueDefinition();
+    semaphore->recursive = false;
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void) {
+    auto semaphore = new QueueDefinition();
+    semaphore->recursive = true;
+    return semaphore;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    delete semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait) {
+    return take(semaphore, ticks_to_wait);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    return give(semaphore);
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait) {
+    return take(semaphore, ticks_to_wait);
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t semaphore) {
+    return give(semaphore);
+}
+
+// the control block is never freed - handles are kept by their owners after the task ended
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t, void *arg,
+                                   UBaseType_t, TaskHandle_t *created_task, BaseType_t) {
+    auto handle = new tskTaskControlBlock();
+    handle->name = name ? name : "";
+    if (created_task)
+        *created_task = handle;
+    std::thread(task_entry, task_start_t{task, arg, handle}).detach();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *created_task) {
+    return xTaskCreatePinnedToCore(task, name, stack_depth, arg, priority, created_task, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (task == nullptr || task == t_current)
+        throw task_exit_t();
+    // deleting another thread is not possible, the component only ends its own tasks
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+
+void taskYIELD(void) {
+    std::this_thread::yield();
+}
+
+// threads not created by xTaskCreate (main, the timer thread) get a handle on first use
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    if (!t_current)
+        t_current = new tskTaskControlBlock();
+    return t_current;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return (TickType_t) (std::chrono::duration_cast<std::chrono::milliseconds>(now).count() / portTICK_PERIOD_MS);
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t) {
+    return 4096;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        task->notified++;
+    }
+    task->cv.notify_one();
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait) {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> lock(task->mutex);
+    auto notified = [task] { return task->notified > 0; };
+    if (ticks_to_wait == portMAX_DELAY)
+        task->cv.wait(lock, notified);
+    else
+        task->cv.wait_for(lock, std::chrono::milliseconds(ticks_to_wait * portTICK_PERIOD_MS), notified);
+
+    uint32_t value = task->notified;
+    if (value > 0)
+        task->notified = clear_on_exit ? 0 : value - 1;
+    return value;
+}
+
+}
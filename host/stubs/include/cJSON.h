@@ -0,0 +1,49 @@
+#pragma once
+#include <stddef.h>
+
+// the subset of cJSON the component uses - a small parser for host builds, not the real library
+
+#define cJSON_Invalid (0)
+#define cJSON_False (1 << 0)
+#define cJSON_True (1 << 1)
+#define cJSON_NULL (1 << 2)
+#define cJSON_Number (1 << 3)
+#define cJSON_String (1 << 4)
+#define cJSON_Array (1 << 5)
+#define cJSON_Object (1 << 6)
+
+typedef struct cJSON {
+    struct cJSON *next;
+    struct cJSON *prev;
+    struct cJSON *child;
+    int type;
+    char *valuestring;
+    int valueint;
+    double valuedouble;
+    char *string;
+} cJSON;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+cJSON *cJSON_Parse(const char *value);
+cJSON *cJSON_ParseWithLength(const char *value, size_t buffer_length);
+void cJSON_Delete(cJSON *item);
+const char *cJSON_GetErrorPtr(void);
+cJSON *cJSON_GetObjectItem(const cJSON *object, const char *string);
+int cJSON_IsNumber(const cJSON *item);
+int cJSON_IsString(const cJSON *item);
+int cJSON_IsBool(const cJSON *item);
+int cJSON_IsTrue(const cJSON *item);
+int cJSON_IsFalse(const cJSON *item);
+int cJSON_IsNull(const cJSON *item);
+int cJSON_IsObject(const cJSON *item);
+int cJSON_IsArray(const cJSON *item);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define cJSON_ArrayForEach(element, array) \
+    for (element = (array != NULL) ? (array)->child : NULL; element != NULL; element = element->next)
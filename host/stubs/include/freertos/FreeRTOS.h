@@ -0,0 +1,23 @@
+#pragma once
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_system.h" // the esp-idf port pulls it in, the component relies on it
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t StackType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xffffffffu
+#define portTICK_PERIOD_MS 1 // CONFIG_FREERTOS_HZ 1000
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms))
+#define tskNO_AFFINITY 0x7fffffff
+#define configMAX_PRIORITIES 25
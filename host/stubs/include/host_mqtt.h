@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "mqtt_client.h"
+
+/*
+ * the broker side of the esp-mqtt stub - benchmarks and the loopback harness drive the client from here
+ * like esp-mqtt every client call and every event dispatch runs under one recursive client lock, so lock order
+ * problems between the mqtt task and the publishers show up on the host as well
+ * events are dispatched on the thread that calls connect/disconnect/deliver, that thread plays the mqtt task
+ */
+namespace host_mqtt {
+    struct message_t {
+        const char *topic; // resolved from the topic alias when it was sent empty
+        int topic_len;
+        const char *data;
+        int len;
+        int qos;
+        int retain;
+        uint16_t topic_alias;
+        uint32_t message_expiry_s;
+        int wire_len; // the whole PUBLISH packet as sent - an aliased topic goes out empty
+    };
+
+    struct stats_t {
+        uint64_t published; // handed to the sink
+        uint64_t bytes; // payload bytes handed to the sink
+        uint64_t wire_bytes; // PUBLISH packets as sent, headers, topic and properties included
+        uint64_t aliased; // sent with an empty topic
+        uint64_t alias_errors; // empty topic with an alias unknown on this connection - a real broker disconnects
+        uint64_t refused; // publish returned -1
+        uint64_t subscribes;
+        uint64_t connects;
+    };
+
+    // what the broker receives, called under the client lock on the publishing thread - keep it short
+    using sink_t = std::function<void(const message_t &message)>;
+
+    // the client created last, there is usually one
+    esp_mqtt_client_handle_t last_client();
+
+    void set_sink(esp_mqtt_client_handle_t client, sink_t sink);
+
+    // a broker without mqtt 5 refuses the connect, topic aliases above the maximum are refused by the client
+    void set_broker(esp_mqtt_client_handle_t client, esp_mqtt_protocol_ver_t max_protocol, uint16_t topic_alias_maximum);
+
+    // false if the client is not started or the broker refused the protocol (MQTT_EVENT_ERROR was dispatched)
+    bool connect(esp_mqtt_client_handle_t client);
+    void disconnect(esp_mqtt_client_handle_t client);
+    bool connected(esp_mqtt_client_handle_t client);
+    esp_mqtt_protocol_ver_t protocol(esp_mqtt_client_handle_t client);
+
+    // MQTT_EVENT_DATA, split into fragments of fragment_size bytes like a small client buffer would, 0 for one event
+    void deliver(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int fragment_size = 0);
+
+    // qos > 0 messages stay in the outbox while held or disconnected, released ones go to the sink in order
+    void hold_outbox(esp_mqtt_client_handle_t client, bool hold);
+
+    stats_t stats(esp_mqtt_client_handle_t client);
+    std::vector<std::string> subscriptions(esp_mqtt_client_handle_t client);
+}
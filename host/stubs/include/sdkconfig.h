@@ -0,0 +1,10 @@
+#pragma once
+// host build configuration - what the component expects from menuconfig
+#define CONFIG_MAIN_TASK_STACK_SIZE 8192
+#define CONFIG_MQTT_PROTOCOL_5 1
+#define CONFIG_ESP_HTTPS_OTA_ALLOW_HTTP 1
+#define CONFIG_ESP_HTTPS_OTA_VERIFY_CERT_CHAIN 1
+#define CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE 1
+#define CONFIG_BOOTLOADER_APP_ANTI_ROLLBACK 1
+#define CONFIG_BOOTLOADER_APP_TEST 1
+#define CONFIG_FREERTOS_NUMBER_OF_CORES 2
@@ -0,0 +1,337 @@
+#include "host_mqtt.h"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+
+// an in-process stand-in for esp-mqtt, nothing goes over a socket - see host_mqtt.h
+
+struct esp_mqtt_client {
+    std::recursive_mutex api_lock; // esp-mqtt's MQTT_API_LOCK, held while events are dispatched
+    esp_mqtt_protocol_ver_t configured = MQTT_PROTOCOL_V_3_1_1;
+    esp_mqtt_protocol_ver_t broker_protocol = MQTT_PROTOCOL_V_5;
+    uint16_t broker_alias_max = 10;
+    esp_mqtt_protocol_ver_t protocol = MQTT_PROTOCOL_UNDEFINED; // of the current connection
+    std::string uri; // esp-mqtt copies the config strings, so does the stub - a dangling pointer shows up here
+    std::vector<std::string> alpn;
+    bool started = false;
+    bool connected = false;
+    bool hold = false;
+    int next_msg_id = 1;
+
+    esp_event_handler_t handler = nullptr;
+    void *handler_arg = nullptr;
+    host_mqtt::sink_t sink;
+
+#if CONFIG_MQTT_PROTOCOL_5
+    esp_mqtt5_publish_property_config_t property = {}; // for the next publish only
+#endif
+    std::vector<std::string> aliases; // broker side, per connection - index is alias - 1
+
+    struct pending_t {
+        std::string topic;
+        std::string data;
+        int qos;
+        int retain;
+    };
+    std::deque<pending_t> outbox;
+    size_t outbox_bytes = 0;
+
+    std::vector<std::string> subscriptions;
+    host_mqtt::stats_t stats = {};
+};
+
+namespace {
+    std::atomic<esp_mqtt_client_handle_t> s_last_client{nullptr};
+
+    void dispatch(esp_mqtt_client_handle_t client, esp_mqtt_event_t &event) {
+        event.client = client;
+        if (client->handler)
+            client->handler(client->handler_arg, "MQTT_EVENTS", event.event_id, &event);
+    }
+
+    size_t varint_size(size_t n) {
+        size_t size = 1;
+        for (; n >= 128; n >>= 7)
+            size++;
+        return size;
+    }
+
+    // fixed header, topic, packet id, properties (mqtt 5 only) and payload
+    size_t wire_size(esp_mqtt_protocol_ver_t protocol, size_t topic_len, int len, int qos, uint16_t alias,
+                     uint32_t expiry_s) {
+        size_t remaining = 2 + topic_len + (qos > 0 ? 2 : 0) + len;
+        if (protocol == MQTT_PROTOCOL_V_5) {
+            size_t properties = (alias ? 3 : 0) + (expiry_s ? 5 : 0);
+            remaining += varint_size(properties) + properties;
+        }
+        return 1 + varint_size(remaining) + remaining;
+    }
+
+    // sent_topic_len is what went on the wire, 0 for an aliased topic
+    void deliver_to_sink(esp_mqtt_client_handle_t client, const char *topic, size_t sent_topic_len, const char *data,
+                         int len, int qos, int retain, uint16_t alias, uint32_t expiry_s) {
+        int wire_len = (int) wire_size(client->protocol, sent_topic_len, len, qos, alias, expiry_s);
+        client->stats.published++;
+        client->stats.bytes += len;
+        client->stats.wire_bytes += wire_len;
+        if (client->sink)
+            client->sink({topic, (int) strlen(topic), data, len, qos, retain, alias, expiry_s, wire_len});
+    }
+
+    void flush_outbox(esp_mqtt_client_handle_t client) {
+        while (client->connected && !client->hold && !client->outbox.empty()) {
+            auto message = std::move(client->outbox.front());
+            client->outbox.pop_front();
+            client->outbox_bytes -= message.data.size();
+            deliver_to_sink(client, message.topic.c_str(), message.topic.size(), message.data.data(),
+                            message.data.size(), message.qos, message.retain, 0, 0);
+        }
+    }
+}
+
+extern "C" {
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config) {
+    auto client = new esp_mqtt_client();
+    if (config)
+        esp_mqtt_set_config(client, config);
+    s_last_client = client;
+    return client;
+}
+
+esp_err_t esp_mqtt_set_config(esp_mqtt_client_handle_t client, const esp_mqtt_client_config_t *config) {
+    std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+    if (config->session.protocol_ver != MQTT_PROTOCOL_UNDEFINED)
+        client->configured = config->session.protocol_ver;
+    if (config->broker.address.uri)
+        client->uri = config->broker.address.uri;
+    client->alpn.clear();
+    for (const char **proto = config->broker.verification.alpn_protos; proto && *proto; proto++)
+        client->alpn.push_back(*proto);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client) {
+    std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+    if (client->started)
+        return ESP_FAIL;
+    client->started = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client) {
+    host_mqtt::disconnect(client);
+    std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+    client->started = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client) {
+    esp_mqtt_client_handle_t expected = client;
+    s_last_client.compare_exchange_strong(expected, nullptr);
+    delete client;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_reconnect(esp_mqtt_client_handle_t client) {
+    return host_mqtt::connect(client) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t,
+                                         esp_event_handler_t event_handler, void *event_handler_arg) {
+    std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+    client->handler = event_handler;
+    client->handler_arg = event_handler_arg;
+    return ESP_OK;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len,
+                            int qos, int retain) {
+    std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+    if (len == 0 && data)
+        len = strlen(data);
+
+    uint16_t alias = 0;
+    uint32_t expiry_s = 0;
+#if CONFIG_MQTT_PROTOCOL_5
+    alias = client->property.topic_alias;
+    expiry_s = client->property.message_expiry_interval;
+    client->property = {};
+#endif
+
+    int msg_id = qos > 0 ? client->next_msg_id++ : 0;
+    if (!client->connected || client->hold) {
+        if (qos == 0 || topic[0] == '\0') {
+            client->stats.refused++;
+            return -1;
+        }
+        client->outbox.push_back({topic, std::string(data ? data : "", len), qos, retain});
+        client->outbox_bytes += len;
+        return msg_id;
+    }
+
+    // the broker resolves aliases per connection
+    size_t sent_topic_len = strlen(topic);
+    if (alias) {
+        if (topic[0] != '\0') {
+            if (client->aliases.size() < alias)
+                client->aliases.resize(alias);
+            client->aliases[alias - 1] = topic;
+        } else if (alias <= client->aliases.size() && !client->aliases[alias - 1].empty()) {
+            topic = client->aliases[alias - 1].c_str();
+            client->stats.aliased++;
+        } else {
+            client->stats.alias_errors++;
+            return msg_id;
+        }
+    } else if (topic[0] == '\0') {
+        client->stats.refused++;
+        return -1;
+    }
+
+    deliver_to_sink(client, topic, sent_topic_len, data, len, qos, retain, alias, expiry_s);
+    return msg_id;
+}
+
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len,
+                            int qos, int retain, bool) {
+    return esp_mqtt_client_publish(client, topic, data, len, qos, retain);
+}
+
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int) {
+    std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+    if (!client->connected)
+        return -1;
+    client->stats.subscribes++;
+    if (std::find(client->subscriptions.begin(), client->subscriptions.end(), topic) == client->subscriptions.end())
+        client->subscriptions.push_back(topic);
+    return client->next_msg_id++;
+}
+
+int esp_mqtt_client_get_outbox_size(esp_mqtt_client_handle_t client) {
+    std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+    return (int) client->outbox_bytes;
+}
+
+#if CONFIG_MQTT_PROTOCOL_5
+esp_err_t esp_mqtt5_client_set_publish_property(esp_mqtt_client_handle_t client,
+                                                const esp_mqtt5_publish_property_config_t *property) {
+    std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+    if (!client->connected || client->protocol != MQTT_PROTOCOL_V_5)
+        return ESP_FAIL;
+    if (property->topic_alias > client->broker_alias_max)
+        return ESP_FAIL;
+    client->property = *property;
+    return ESP_OK;
+}
+#endif
+
+}
+
+namespace host_mqtt {
+    esp_mqtt_client_handle_t last_client() {
+        return s_last_client;
+    }
+
+    void set_sink(esp_mqtt_client_handle_t client, sink_t sink) {
+        std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+        client->sink = std::move(sink);
+    }
+
+    void set_broker(esp_mqtt_client_handle_t client, esp_mqtt_protocol_ver_t max_protocol, uint16_t topic_alias_maximum) {
+        std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+        client->broker_protocol = max_protocol;
+        client->broker_alias_max = topic_alias_maximum;
+    }
+
+    bool connect(esp_mqtt_client_handle_t client) {
+        std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+        if (!client->started || client->connected)
+            return false;
+
+        esp_mqtt_event_t event = {};
+        if (client->configured > client->broker_protocol) {
+            esp_mqtt_error_codes_t error = {};
+            error.error_type = MQTT_ERROR_TYPE_CONNECTION_REFUSED;
+            error.connect_return_code = MQTT_CONNECTION_REFUSE_PROTOCOL;
+            event.event_id = MQTT_EVENT_ERROR;
+            event.error_handle = &error;
+            dispatch(client, event);
+            return false;
+        }
+
+        client->connected = true;
+        client->protocol = client->configured;
+        client->aliases.clear();
+        client->subscriptions.clear(); // clean session
+        client->stats.connects++;
+        event.event_id = MQTT_EVENT_CONNECTED;
+        event.protocol_ver = client->protocol;
+        dispatch(client, event);
+        flush_outbox(client);
+        return true;
+    }
+
+    void disconnect(esp_mqtt_client_handle_t client) {
+        std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+        if (!client->connected)
+            return;
+        client->connected = false;
+        client->protocol = MQTT_PROTOCOL_UNDEFINED;
+        esp_mqtt_event_t event = {};
+        event.event_id = MQTT_EVENT_DISCONNECTED;
+        dispatch(client, event);
+    }
+
+    bool connected(esp_mqtt_client_handle_t client) {
+        std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+        return client->connected;
+    }
+
+    esp_mqtt_protocol_ver_t protocol(esp_mqtt_client_handle_t client) {
+        std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+        return client->protocol;
+    }
+
+    void deliver(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int fragment_size) {
+        std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+        if (!client->connected)
+            return;
+        if (fragment_size <= 0)
+            fragment_size = std::max(len, 1);
+
+        int offset = 0;
+        do {
+            esp_mqtt_event_t event = {};
+            event.event_id = MQTT_EVENT_DATA;
+            // only the first fragment carries the topic
+            if (offset == 0) {
+                event.topic = (char *) topic;
+                event.topic_len = strlen(topic);
+            }
+            event.data = (char *) data + offset;
+            event.data_len = std::min(fragment_size, len - offset);
+            event.total_data_len = len;
+            event.current_data_offset = offset;
+            dispatch(client, event);
+            offset += event.data_len;
+        } while (offset < len);
+    }
+
+    void hold_outbox(esp_mqtt_client_handle_t client, bool hold) {
+        std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+        client->hold = hold;
+        flush_outbox(client);
+    }
+
+    stats_t stats(esp_mqtt_client_handle_t client) {
+        std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+        return client->stats;
+    }
+
+    std::vector<std::string> subscriptions(esp_mqtt_client_handle_t client) {
+        std::lock_guard<std::recursive_mutex> lock(client->api_lock);
+        return client->subscriptions;
+    }
+}
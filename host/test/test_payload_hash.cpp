@@ -0,0 +1,44 @@
+#include <cstdio>
+#include <apptools/ha_discovery.h>
+#include <apptools/hash_utils.h>
+
+// publish_on_change compares payload hashes - values that round to the same decimals must hash the same in json and cbor
+
+#define PAYLOAD_SIZE 256
+
+static int s_failures = 0;
+
+static uint32_t state_hash(double value, int decimals, ha_discovery::state_encoding_t encoding) {
+    char payload[PAYLOAD_SIZE];
+    ha_discovery::payload_writer_t writer(payload, sizeof(payload), encoding);
+    writer.add("temperature", value, decimals);
+    size_t len = writer.finish();
+    return fnv1a_32(payload, len);
+}
+
+static void expect_hash(double a, double b, int decimals, bool same) {
+    const ha_discovery::state_encoding_t encodings[] = {ha_discovery::state_encoding_t::JSON,
+                                                        ha_discovery::state_encoding_t::CBOR};
+    for (auto encoding : encodings) {
+        bool equal = state_hash(a, decimals, encoding) == state_hash(b, decimals, encoding);
+        if (equal != same) {
+            printf("FAIL %s: %.4f and %.4f at %d decimals hash %s\n",
+                   encoding == ha_discovery::state_encoding_t::CBOR ? "cbor" : "json", a, b, decimals,
+                   equal ? "the same" : "differently");
+            s_failures++;
+        }
+    }
+}
+
+int main() {
+    expect_hash(21.3401, 21.3423, 1, true);
+    expect_hash(21.3401, 21.2999, 1, true);
+    expect_hash(21.34, 21.36, 1, false);
+    expect_hash(-5.1231, -5.1249, 2, true);
+    expect_hash(-0.04, 0.04, 1, true);
+    expect_hash(1013.25, 1013.2549, 2, true);
+    expect_hash(0.123456, 0.123457, 6, false);
+    expect_hash(1.0e17, 1.0e17, 1, true);
+    printf("%s\n", s_failures ? "FAILED" : "ok");
+    return s_failures ? 1 : 0;
+}
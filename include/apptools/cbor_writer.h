@@ -0,0 +1,77 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+/*
+ * bounded, append-only cbor (rfc 8949) writer on a caller supplied buffer - the binary twin of json_writer
+ * maps and arrays are indefinite length so nothing has to be counted up front
+ * a write that does not fit is dropped whole and flags overflow(), the buffer always holds the last good prefix
+ */
+class cbor_writer {
+public:
+    cbor_writer(char *buffer, size_t size) : buffer_((uint8_t *) buffer), size_(size) {
+    }
+
+    cbor_writer &begin_map(const char *key = nullptr);
+    cbor_writer &begin_array(const char *key = nullptr);
+    cbor_writer &end(); // closes the innermost map or array
+
+    cbor_writer &key(const char *key);
+
+    cbor_writer &value(const char *str); // nullptr is written as null
+    cbor_writer &value(bool v);
+    // float32 when that keeps the requested decimals, float64 otherwise - non finite values are written as null
+    cbor_writer &value(double v, int decimals);
+    cbor_writer &value_int(int64_t v);
+    cbor_writer &null();
+
+    template<typename T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, cbor_writer &>::type
+    value(T v) {
+        return value_int((int64_t) v);
+    }
+
+    // key and value, dropped together if they do not fit
+    template<typename T>
+    cbor_writer &field(const char *k, T v) {
+        size_t m = mark();
+        uint32_t dropped = dropped_;
+        if (key(k).value(v).dropped_ != dropped)
+            rollback(m);
+        return *this;
+    }
+
+    cbor_writer &field(const char *k, double v, int decimals) {
+        size_t m = mark();
+        uint32_t dropped = dropped_;
+        if (key(k).value(v, decimals).dropped_ != dropped)
+            rollback(m);
+        return *this;
+    }
+
+    inline const char *data() const { return (const char *) buffer_; }
+    inline size_t length() const { return len_; }
+    inline bool overflow() const { return dropped_ > 0; }
+    inline uint32_t dropped() const { return dropped_; } // number of writes that did not fit
+
+    // keep n bytes free for a break written later
+    inline void reserve(size_t n) { size_ -= n; }
+    inline void release(size_t n) { size_ += n; }
+
+    // nesting is not tracked, a mark is just the length
+    inline size_t mark() const { return len_; }
+    inline void rollback(size_t m) { len_ = m; }
+
+private:
+    bool put(uint8_t b);
+    bool put(const void *p, size_t n);
+    bool put_head(uint8_t major, uint64_t v);
+    bool put_text(const char *s);
+    cbor_writer &fail(size_t m);
+
+    uint8_t *buffer_;
+    size_t size_;
+    size_t len_ = 0;
+    uint32_t dropped_ = 0;
+};
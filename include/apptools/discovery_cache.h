@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ha_discovery {
+    struct device_info_t;
+    class sensor_wrapper_t;
+}
+
+/*
+ * what discovery messages were sent with - a hash per entity, the payload is rendered again when it is published
+ * a reconnect only sends the ones whose content changed
+ * not thread safe, the owner serializes access
+ */
+class discovery_cache {
+public:
+    // where the entity comes from, the owner renders the payload from it
+    struct source_t {
+        const ha_discovery::device_info_t *device; // nullptr for the main device
+        const ha_discovery::sensor_wrapper_t *sensor; // nullptr for a built-in entity
+        const char *state_topic; // interned, see topic_table
+        const char *command_topic; // interned, nullptr if not controllable
+        uint16_t index; // into the sensor's control configs or the built-in entities
+    };
+
+    struct entry_t {
+        const char *topic; // interned, see topic_table
+        source_t source;
+        uint32_t hash;
+        uint16_t len;
+        bool dirty; // not yet (re)published with this content
+    };
+
+    // store or replace the hash of the payload for an interned topic, returns true if the content changed
+    bool set(const char *topic, const source_t &source, const char *payload, size_t len);
+
+    // republish everything, e.g. when home assistant restarts
+    void invalidate();
+
+    size_t pending() const;
+
+    inline size_t size() const { return entries_.size(); }
+
+    // bytes held by the entries, topics are accounted in the topic table
+    size_t footprint() const;
+
+    inline std::vector<entry_t> &entries() { return entries_; }
+
+private:
+    std::vector<entry_t> entries_;
+};
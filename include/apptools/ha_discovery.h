@@ -3,6 +3,11 @@
 #include <memory>
 #include <functional>
 #include <vector>
+#include <string>
+#include <utility>
+#include <type_traits>
+#include <apptools/json_writer.h>
+#include <apptools/cbor_writer.h>
 
 // this is based on home assistants device structure
 namespace ha_discovery {
@@ -29,6 +34,8 @@ namespace ha_discovery {
         const char *state_off; // Optional: for switch/binary_sensor
         const char *payload_on; // Optional: for switch
         const char *payload_off; // Optional: for switch
+        uint32_t update_window_s = 0; // written only this often - added to HA's expire_after
+        uint32_t update_interval_ms = 0; // polled this often - HA's expire_after has to outlast it
 
         // Constructor with all fields, providing defaults
         control_config_t(
@@ -124,21 +131,216 @@ namespace ha_discovery {
         }
     };
 
+    // wire format of state messages, the keys are the value_key of the entities either way
+    enum class state_encoding_t {
+        JSON,
+        CBOR // one map per message, see tools/cbor_bridge.py for the json side
+    };
+
+    // per value_key deadband - a value inside the band is written as the last sent one,
+    // so change detection sees no change and the sensor is not republished
+    class deadband_filter_t {
+    public:
+        void set(const char *value_key, float absolute, float relative);
+        inline bool empty() const { return bands_.empty(); }
+
+        double apply(const char *value_key, double value);
+        // the values handed out since the last commit were sent
+        void commit();
+
+    private:
+        struct band_t {
+            const char *key;
+            float absolute;
+            float relative; // fraction of the last sent value
+            double sent;
+            double pending;
+            bool has_sent;
+            bool has_pending;
+        };
+
+        std::vector<band_t> bands_;
+    };
+
+    class payload_writer_t;
+
+    // min, max, mean, count and last per value_key over a time window - constant memory per key
+    // the sensor is polled at its own interval, the aggregates are written once per window
+    class aggregator_t {
+    public:
+        static constexpr size_t MAX_KEY_LENGTH = 48;
+
+        void add(const char *value_key, int decimals);
+        inline bool empty() const { return windows_.empty(); }
+        inline void set_window_ms(uint32_t ms) { window_ms_ = ms; }
+        inline uint32_t window_ms() const { return window_ms_; }
+
+        // true if value_key is aggregated - the value is taken in instead of written
+        bool absorb(const char *value_key, double value, int64_t now_ms);
+        bool due(int64_t now_ms) const;
+        // writes key (last), key_min, key_max, key_mean and key_count, then starts a new window
+        void flush(payload_writer_t &writer, int64_t now_ms);
+
+        // discovery entries for the aggregates, derived from the entity of the plain key
+        // the plain key and the aggregates get the window as update_window_s
+        void add_configs(std::vector<control_config_t> &configs) const;
+
+    private:
+        enum { AGG_MIN, AGG_MAX, AGG_MEAN, AGG_COUNT, AGG_KINDS };
+
+        struct window_t {
+            const char *key;
+            int decimals;
+            double min;
+            double max;
+            double sum;
+            double last;
+            uint32_t count;
+            char keys[AGG_KINDS][MAX_KEY_LENGTH];
+            char names[AGG_KINDS][MAX_KEY_LENGTH];
+        };
+
+        // heap allocated so the key and name strings stay put for discovery
+        std::vector<std::unique_ptr<window_t> > windows_;
+        uint32_t window_ms_ = 60000;
+        int64_t window_start_ms_ = 0;
+    };
+
+    // writes "key": value pairs straight into the outgoing state buffer - no heap allocation
+    class payload_writer_t {
+    public:
+        struct mark_t {
+            json_writer::mark_t json;
+            size_t cbor;
+            size_t fields;
+        };
+
+        // opens the state object, one byte is kept back for the closing bracket (or cbor break)
+        payload_writer_t(char *buffer, size_t size, state_encoding_t encoding = state_encoding_t::JSON);
+
+        void add(const char *key, bool value);
+        void add(const char *key, double value, int decimals = 2);
+        void add(const char *key, const char *value);
+
+        template<typename T>
+        typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type
+        add(const char *key, T value) {
+            add_int(key, (int64_t) value);
+        }
+
+        // already formatted fragment - "key": value[, "key2": value2]
+        // in cbor mode the fragment is parsed and re-encoded, flat values only
+        void add_raw(const char *fragment, size_t len);
+
+        // closes the object, returns the payload length
+        size_t finish();
+
+        // numeric values pass through this deadband until reset with nullptr
+        inline void set_filter(deadband_filter_t *filter) { filter_ = filter; }
+        // numeric values of aggregated keys go to the aggregator instead of the payload
+        inline void set_aggregator(aggregator_t *aggregator, int64_t now_ms) {
+            aggregator_ = aggregator;
+            now_ms_ = now_ms;
+        }
+
+        inline bool binary() const { return encoding_ == state_encoding_t::CBOR; }
+        inline const char *data() const { return binary() ? cbor_.data() : json_.data(); }
+        inline size_t length() const { return binary() ? cbor_.length() : json_.length(); }
+        inline size_t fields() const { return fields_; }
+        inline bool overflow() const { return binary() ? cbor_.overflow() : json_.overflow(); }
+
+        // everything written after mark() can be inspected and dropped again
+        inline mark_t mark() const { return {json_.mark(), cbor_.mark(), fields_}; }
+        inline void rollback(const mark_t &m) {
+            json_.rollback(m.json);
+            cbor_.rollback(m.cbor);
+            fields_ = m.fields;
+        }
+        // bytes written since mark without the leading separator
+        const char *written_since(const mark_t &m, size_t *len) const;
+
+    private:
+        void add_int(const char *key, int64_t value);
+        void add_raw_cbor(const char *fragment, size_t len);
+        inline uint32_t dropped() const { return binary() ? cbor_.dropped() : json_.dropped(); }
+        void commit(const mark_t &m, uint32_t dropped);
+
+        state_encoding_t encoding_;
+        deadband_filter_t *filter_ = nullptr;
+        aggregator_t *aggregator_ = nullptr;
+        int64_t now_ms_ = 0;
+        json_writer json_;
+        cbor_writer cbor_;
+        size_t fields_ = 0;
+    };
+
     class sensor_wrapper_t {
     public:
         using DiscoveryFunc = std::function<std::vector<control_config_t>()>;
         using PayloadFunc = std::function<std::string()>;
+        using WriterFunc = std::function<void(payload_writer_t &)>;
+        // runs in the mqtt event task, data is a view into the client buffer - only valid during the call
+        using CommandFunc = std::function<void(const char *data, int data_len)>;
 
         sensor_wrapper_t(uint32_t min_intervall_ms, DiscoveryFunc discovery, PayloadFunc payload);
+        sensor_wrapper_t(uint32_t min_intervall_ms, DiscoveryFunc discovery, WriterFunc writer);
+
+        // includes the entities generated for aggregated keys
+        std::vector<control_config_t> get_control_config() const;
+        // compatibility - sensors built with a WriterFunc pay for a temporary string here
+        std::string get_payload() const;
+        // zero allocation path used by the publisher, falls back to PayloadFunc
+        void write_payload(payload_writer_t &writer) const;
 
-        std::vector<control_config_t> get_control_config() const { return discoveryFunc_(); }
-        std::string get_payload() const { return payloadFunc_(); }
+        // command callback for a controllable entity of this sensor, register before the sensor is
+        // handed to ha_mqtt_handler::add_sensor or device_info_t::add_sensor
+        void on_command(const char *value_key, CommandFunc func);
+        const CommandFunc *command_handler(const char *value_key) const;
+
+        // a numeric value of value_key that moved less than max(absolute, relative * |last sent|) does not
+        // count as a change - the sensor is published when something left its band, before HA's
+        // expire_after runs out, or when max_silence_ms passed without a publish
+        void set_deadband(const char *value_key, float absolute, float relative = 0);
+        inline void set_max_silence_ms(uint32_t ms) { max_silence_ms_ = ms; }
+        inline uint32_t max_silence_ms() const { return max_silence_ms_; }
+        inline bool has_deadband() const { return !deadband_.empty(); }
+        inline deadband_filter_t &deadband() { return deadband_; }
+
+        // value_key is sampled at min_intervall_ms and published as value_key plus value_key_min, _max,
+        // _mean and _count once per window - call before the sensor is handed to the mqtt handler
+        void aggregate(const char *value_key, int decimals = 2);
+        inline void set_aggregation_window_ms(uint32_t ms) { aggregator_.set_window_ms(ms); }
+        inline bool has_aggregation() const { return !aggregator_.empty(); }
+        inline aggregator_t &aggregator() { return aggregator_; }
+
+        inline uint32_t min_intervall_ms() const { return min_intervall_ms_; }
+        // upper bound when the publish governor stretches intervals, 0 == up to HA's expire_after
+        inline uint32_t max_intervall_ms() const { return max_intervall_ms_; }
+        inline void set_max_intervall_ms(uint32_t ms) { max_intervall_ms_ = ms; }
+        inline int64_t next_update_ms() const { return next_update_ms_; }
+        inline void set_next_update_ms(int64_t ts) { next_update_ms_ = ts; }
+
+        // change detection - what we last sent for this sensor and when
+        inline uint32_t last_payload_hash() const { return last_payload_hash_; }
+        inline int64_t last_publish_ms() const { return last_publish_ms_; }
+        inline void set_published(uint32_t hash, int64_t ts) {
+            last_payload_hash_ = hash;
+            last_publish_ms_ = ts;
+        }
 
     private:
         DiscoveryFunc discoveryFunc_;
         PayloadFunc payloadFunc_;
+        WriterFunc writerFunc_;
+        std::vector<std::pair<const char *, CommandFunc> > commands_;
+        deadband_filter_t deadband_;
+        aggregator_t aggregator_;
+        uint32_t max_silence_ms_ = 0;
         uint32_t min_intervall_ms_;
+        uint32_t max_intervall_ms_ = 0;
         int64_t next_update_ms_ = 0;
+        uint32_t last_payload_hash_ = 0;
+        int64_t last_publish_ms_ = 0;
     };
 
     struct device_info_t {
@@ -1,11 +1,23 @@
  #pragma once
 #include "mqtt_client.h"
 #include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include <memory>
+#include <atomic>
 //#include <functional>
 #include <apptools/ota_handler.h>
 #include "apptools/device_config.h"
 #include <apptools/ha_discovery.h>
+#include <apptools/publish_scheduler.h>
+#include <apptools/discovery_cache.h>
+#include <apptools/token_bucket.h>
+#include <apptools/topic_table.h>
+#include <apptools/topic_router.h>
+#include <apptools/publish_gate.h>
+#include <apptools/publish_governor.h>
+#include <apptools/snapshot.h>
+#include "freertos/semphr.h"
 
 #if CONFIG_MAIN_TASK_STACK_SIZE < 4096
 #error "Main task stack size must be at least 4096 bytes. menuconfig: Component config → ESP System Settings → Main task stack size"
@@ -13,12 +25,35 @@
 
 class LogCollector;
 
+// state publishing runs in its own task so sensor i/o never blocks the esp_timer task
+struct publisher_config_t {
+    UBaseType_t priority = 4; // below the mqtt client task
+    uint32_t stack_size = 4096;
+    BaseType_t core_id = tskNO_AFFINITY;
+    // discovery is paced so state and command traffic is not stuck behind a burst of retained configs
+    uint32_t discovery_messages_per_s = 10;
+    uint32_t discovery_bytes_per_s = 4096;
+    // what we let pile up in the mqtt outbox while the broker is slow or away
+    size_t outbox_budget_bytes = 16384;
+    // mqtt 5 only - state topics that are sent as a 2 byte alias after their first publish
+    uint16_t topic_aliases = 8;
+    // stretch sensor intervals under cpu, heap or outbox pressure
+    governor_config_t governor;
+};
+
+struct discovery_progress_t {
+    size_t sent; // in the current (or last) round
+    size_t pending;
+    size_t total;
+};
+
 /*
  * implements home assistant sensors and registration in a somewhat generic way
  */
 class ha_mqtt_handler {
 public:
 
+    // an mqtt 5 config is kept for the fallback to 3.1.1, its strings, certificates and keys are copied
     ha_mqtt_handler(const esp_mqtt_client_config_t *mqtt_config,  const device_config_t* config, ota_handler *ota_handler);
 
     virtual ~ha_mqtt_handler();
@@ -27,41 +62,149 @@ public:
 
     void enable_logging(LogCollector*);
 
-    void add_sensor(std::shared_ptr<ha_discovery::sensor_wrapper_t> sensor) {
-        sensors_.push_back(sensor);
-    }
+    void add_sensor(std::shared_ptr<ha_discovery::sensor_wrapper_t> sensor);
 
     void add_managed_device(std::shared_ptr<ha_discovery::device_info_t>);
     void update_managed_device(const char* eid, const char* sw_tag, const char* sw_sha256);
 
-    void start();
+    void start(const publisher_config_t &publisher = publisher_config_t());
+
+    // only send sensors whose payload changed, unchanged ones are refreshed before HA's expire_after runs out
+    void set_publish_on_change(bool on) { publish_on_change_ = on; }
+
+    // cbor state goes to <state topic>/cbor, home assistant needs tools/cbor_bridge.py to read it
+    void set_state_encoding(ha_discovery::state_encoding_t encoding) {
+        state_encoding_ = encoding;
+        request_full_state();
+    }
 
+    // (re)subscribes and queues discovery messages that changed since they were last published
     void publish_auto_discovery();
+
+    discovery_progress_t discovery_progress();
+
+    inline size_t topic_footprint() const { return topics_.footprint(); }
+
+    // what the outbox budget cost us so far
+    inline publish_gate::stats_t publish_stats() const { return gate_.stats(); }
+    // latency histograms, bytes and failures per publish path - also reported as built-in sensors
+    inline const publish_telemetry &telemetry() const { return telemetry_; }
+
+    // upper bound for reassembling a message that arrives in several MQTT_EVENT_DATA fragments
+    void set_max_message_size(size_t bytes) { max_message_size_ = bytes; }
+
+    // command payloads handed over fragment by fragment as they arrive - nothing is buffered,
+    // for payloads larger than the client buffer that should not be reassembled in ram
+    void add_chunked_command(const char *value_key, topic_router::chunk_handler_t handler);
 protected:
-    void publish_discovery(const ha_discovery::control_config_t &config);
+    // everything registration adds to - readers get an immutable snapshot, see snapshot.h
+    struct registry_t {
+        std::vector<std::shared_ptr<ha_discovery::sensor_wrapper_t>> sensors;
+        std::vector<std::shared_ptr<ha_discovery::device_info_t>> sub_devices;
+        std::vector<const char *> sub_device_state_topics; // parallel to sub_devices
+        std::vector<const char *> sub_device_cbor_topics; // parallel to sub_devices
+        std::vector<const char *> command_topics; // subscribed on every connect
+        topic_router router;
+    };
+
+    // discovery_cache_ keeps a hash per entity from registration, the payload is rendered again when it is sent
+    size_t render_discovery(const ha_discovery::control_config_t &config, const discovery_cache::source_t &source,
+                            char *payload, size_t size);
+    size_t render_discovery(const discovery_cache::source_t &source, char *payload, size_t size);
+    void cache_discovery(const ha_discovery::control_config_t &config, discovery_cache::source_t source);
+    void cache_discovery(const ha_discovery::sensor_wrapper_t &sensor);
+    void cache_discovery(std::shared_ptr<ha_discovery::device_info_t>, const char *state_topic);
+    void cache_builtin_discovery();
+    void publish_pending_discovery();
+    int64_t pump_discovery(int64_t now_ms);
 
     void subscribe_topics(std::shared_ptr<ha_discovery::device_info_t>);
-    void publish_discovery(std::shared_ptr<ha_discovery::device_info_t>);
+
+    // every topic is formatted once into topics_, nothing is formatted on the publish paths
+    void intern_topics();
+    // subscribed on every connect and dispatched by the registry router
+    static void track_command_topic(registry_t &registry, const char *topic);
+    void add_command_route(const char *topic, topic_router::handler_t handler);
+    const char *command_topic(const ha_discovery::device_info_t *device, const char *value_key);
+    void add_sensor_commands(const ha_discovery::sensor_wrapper_t &sensor, const ha_discovery::device_info_t *device);
 
     void event_handler(esp_event_base_t base, int32_t event_id, void *event_data);
     static void event_handler_wrapper(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data);
-    void handle_control_message(const char* topic,  int topic_len, const char* data, int data_len);
-
-    static void publish_state_wrapper(void* arg);
-    void publish_state();
+    void handle_control_message(const registry_t &registry, const char* topic,  int topic_len, const char* data, int data_len);
+    void handle_data(const registry_t &registry, esp_mqtt_event_handle_t event);
+    void handle_connect_error(esp_mqtt_event_handle_t event);
+    void keep_config(const esp_mqtt_client_config_t *mqtt_config);
+    void keep_string(const char *&str, size_t len = 0);
+    void *keep_bytes(const void *data, size_t len);
+    void release_reassembly();
+    const char *terminated(const char *data, int data_len) const;
+
+    static void state_timer_wrapper(void* arg);
+    static void publisher_task_wrapper(void* arg);
+    void publisher_loop();
+    void publish_state(const registry_t &registry, bool rebuild);
+    void write_telemetry(ha_discovery::payload_writer_t &writer, int64_t now_ms);
+
+    // sensors are polled from a deadline heap, the one-shot state timer only notifies the publisher task
+    void rebuild_schedule(const registry_t &registry);
+    void request_full_state();
+    void wake_publisher();
+    void arm_state_timer(int64_t delay_ms);
+    void update_governor(int64_t now_ms);
 
     void send_logs(const char* logs, size_t size);
 
     esp_mqtt_client_handle_t mqtt_client_ = nullptr;
+    esp_mqtt_client_config_t mqtt_config_ = {};
+    std::vector<std::unique_ptr<char[]>> mqtt_config_strings_; // what mqtt_config_ points to
+    bool fallback_ = false; // mqtt_config_ is kept, mqtt 5 may still fall back to 3.1.1
     const device_config_t *config_ = nullptr;
     ota_handler *ota_handler_ = nullptr;
     LogCollector* log_collector_= nullptr;
 
     int64_t built_in_sensor_next_ts_ = 0;
 
-    std::vector<std::shared_ptr<ha_discovery::sensor_wrapper_t>> sensors_;
-    std::vector<std::shared_ptr<ha_discovery::device_info_t>> sub_devices_;
+    // published by registration, read without a lock by the publisher and the mqtt task
+    snapshot<registry_t> registry_;
+    SemaphoreHandle_t registry_mutex_ = nullptr; // recursive, serializes registration
+
+    topic_table topics_;
+    const char *state_topic_ = nullptr;
+    const char *state_cbor_topic_ = nullptr;
+    const char *logs_topic_ = nullptr;
+
+    // fragmented message in flight - fragments of one message arrive back to back
+    size_t max_message_size_ = 8192;
+    const char *inflight_topic_ = nullptr;
+    int inflight_topic_len_ = 0;
+    char *reassembly_ = nullptr;
+    int reassembly_len_ = 0;
+
+    publish_gate gate_;
+    publish_telemetry telemetry_;
+    publish_governor governor_;
+    int64_t governor_next_ms_ = 0;
+    publish_telemetry::path_stats_t telemetry_reported_[publish_telemetry::PATH_COUNT] = {};
+    int64_t telemetry_reported_ms_ = 0;
+    publish_scheduler scheduler_;
+    std::vector<publish_scheduler::entry_t> due_;
+    std::atomic<bool> schedule_dirty_{true};
+    std::atomic<bool> force_publish_{false};
+    bool publish_on_change_ = false;
+    std::atomic<ha_discovery::state_encoding_t> state_encoding_{ha_discovery::state_encoding_t::JSON};
+
+    discovery_cache discovery_cache_;
+    SemaphoreHandle_t discovery_mutex_ = nullptr;
+    std::atomic<bool> connected_{false};
+    std::atomic<bool> discovery_pending_{false};
+    token_bucket discovery_messages_;
+    token_bucket discovery_bytes_;
+    size_t discovery_sent_ = 0;
+    size_t discovery_sent_bytes_ = 0;
+    int64_t discovery_round_start_ms_ = 0;
 
     esp_timer_handle_t state_timer_ = nullptr;
+    std::atomic<TaskHandle_t> publisher_task_{nullptr};
+    std::atomic<bool> publisher_stop_{false};
     bool reboot_pending_ = false;
 };
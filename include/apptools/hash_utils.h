@@ -0,0 +1,14 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// FNV-1a, cheap enough to run on every payload - not for anything security related
+constexpr uint32_t FNV1A_32_SEED = 2166136261u;
+
+inline uint32_t fnv1a_32(const char *data, size_t len, uint32_t hash = FNV1A_32_SEED) {
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t) data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+/*
+ * bounded, append-only json writer on a caller supplied buffer - no heap, no printf on the common paths
+ * a write that does not fit is dropped whole and flags overflow(), the buffer always holds the last good prefix
+ * the output is not null terminated, use data()/length()
+ */
+class json_writer {
+public:
+    struct mark_t {
+        size_t len;
+        uint32_t first;
+        uint8_t depth;
+        bool after_key;
+    };
+
+    json_writer(char *buffer, size_t size) : buffer_(buffer), size_(size) {
+    }
+
+    json_writer &begin_object(const char *key = nullptr);
+    json_writer &end_object();
+    json_writer &begin_array(const char *key = nullptr);
+    json_writer &end_array();
+
+    json_writer &key(const char *key);
+
+    json_writer &value(const char *str); // escaped, nullptr is written as null
+    json_writer &value(bool v);
+    json_writer &value(double v, int decimals); // fixed point, non finite values are written as null
+    json_writer &value_int(int64_t v);
+    json_writer &null();
+
+    template<typename T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, json_writer &>::type
+    value(T v) {
+        return value_int((int64_t) v);
+    }
+
+    // a string value built from several escaped parts (at most max_len chars each), dropped whole if it does not fit
+    json_writer &string_begin(const char *key = nullptr);
+    json_writer &string_append(const char *str, size_t max_len = SIZE_MAX);
+    json_writer &string_end();
+
+    // already rendered json written as one element
+    json_writer &raw(const char *json, size_t len);
+
+    // key and value, dropped together if they do not fit
+    template<typename T>
+    json_writer &field(const char *k, T v) {
+        mark_t m = mark();
+        uint32_t dropped = dropped_;
+        if (key(k).value(v).dropped_ != dropped)
+            rollback(m);
+        return *this;
+    }
+
+    json_writer &field(const char *k, double v, int decimals) {
+        mark_t m = mark();
+        uint32_t dropped = dropped_;
+        if (key(k).value(v, decimals).dropped_ != dropped)
+            rollback(m);
+        return *this;
+    }
+
+    inline const char *data() const { return buffer_; }
+    inline size_t length() const { return len_; }
+    inline bool overflow() const { return dropped_ > 0; }
+    inline uint32_t dropped() const { return dropped_; } // number of writes that did not fit
+    inline uint8_t depth() const { return depth_; }
+
+    // keep n bytes free for a closing bracket written later
+    inline void reserve(size_t n) { size_ -= n; }
+    inline void release(size_t n) { size_ += n; }
+
+    inline mark_t mark() const { return {len_, first_, depth_, after_key_}; }
+    void rollback(const mark_t &m);
+
+private:
+    bool separator();
+    bool put(char c);
+    bool put(const char *s, size_t n);
+    bool put_escaped(const char *s, size_t max_len);
+    bool put_uint(uint64_t v);
+    json_writer &fail(const mark_t &m);
+
+    char *buffer_;
+    size_t size_;
+    size_t len_ = 0;
+    uint32_t first_ = 1; // bit per nesting level - next element is the first one
+    uint8_t depth_ = 0;
+    bool after_key_ = false;
+    uint32_t dropped_ = 0;
+    mark_t string_mark_ = {};
+    bool string_failed_ = false;
+};
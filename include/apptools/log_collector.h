@@ -1,15 +1,45 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 
+struct timeval;
+
 class LogCollector {
 public:
     using LogSendCallback = std::function<void(const char*, size_t)>;
 
+    enum class capture_mode_t {
+        // formatted once into the ring, the same bytes are written to stdout
+        FORMAT_ONCE,
+        // only the format string pointer and the raw arguments are stored, formatted when sent
+        // nothing goes to stdout - for devices without a console. format strings must be static (ESP_LOGx ones are)
+        DEFERRED,
+    };
+
+    // the prefix of every line, the compact ones are plain integers for the reader to expand
+    enum class timestamp_t {
+        CALENDAR, // 2024-01-31 12:34:56.789 local time
+        EPOCH_MS, // milliseconds since 1970
+        MONOTONIC_MS, // milliseconds since boot, for devices without a synced clock
+    };
+
+    struct stats_t {
+        uint32_t captured; // lines written to the ring
+        uint32_t sent;
+        uint32_t dropped; // never sent - overwritten by newer lines, includes busy
+        uint32_t busy; // slot still being written by a producer one lap behind - line not captured
+        uint32_t truncated; // longer than a slot
+    };
+
+    static constexpr size_t LOG_TIME_MAX = 32; // what a timestamp prefix may take, with the terminator
+
     static LogCollector& instance();
 
     // Delete copy and assignment operators
@@ -19,9 +49,17 @@ public:
     // Set callback for sending logs (called when MQTT is ready)
     void set_callback(LogSendCallback callback);
 
-    // Stop sending logs (e.g., if MQTT disconnects)
+    // Stop sending logs (e.g., if MQTT disconnects), waits for a flush that is running
     void detach_callback();
 
+    void set_capture_mode(capture_mode_t mode) { mode_.store(mode, std::memory_order_relaxed); }
+    void set_timestamp(timestamp_t timestamp) { timestamp_.store(timestamp, std::memory_order_relaxed); }
+
+    // the prefix a line captured now gets, in the current timestamp setting - returns its length
+    size_t timestamp_prefix(char *out);
+
+    stats_t stats() const;
+
 private:
     // Private constructor - called automatically before main
     LogCollector();
@@ -29,25 +67,71 @@ private:
 
     static int log_vprintf_wrapper(const char *fmt, va_list args);
     int log_vprintf(const char *fmt, va_list args);
-    static void send_logs_wrapper(void* arg);
+    static void check_flush_wrapper(void* arg);
+    void check_flush();
     void send_logs();
     bool initialize_timer();
+    void flush_chunk(const LogSendCallback &callback, size_t &len);
+    void capture_time(struct timeval &tv) const;
+    size_t format_time(const struct timeval &tv, char *out);
 
     // Static instance for early initialization
     static LogCollector instance_;
 
-    // Buffer management
-    static constexpr size_t LOG_BUFFER_SIZE = 32768; // 32KB buffer
-    char log_buffer_[LOG_BUFFER_SIZE];
-    size_t log_buffer_pos_;
+    /*
+     * multi-producer ring of fixed size line slots, the oldest lines are overwritten
+     * a producer takes a ticket, claims the slot by making its sequence odd and commits by making it even again
+     * the single consumer (send_logs) claims a committed slot the same way while it copies it,
+     * so a producer a lap ahead finds it busy instead of overwriting the copy
+     * sequences wrap after 2^31 lines, they are only compared as signed differences
+     */
+    static constexpr size_t LOG_SLOTS = 128; // a power of two, so ticket % LOG_SLOTS survives the wrap
+    static constexpr size_t LOG_SLOT_SIZE = 248; // 256 bytes per slot with the header
+    static constexpr size_t LOG_SEND_CHUNK = 4096;
+    static constexpr size_t LOG_LINE_MAX = 512; // a deferred line formatted at send time
+    static constexpr uint32_t LOG_HIGH_WATER_SLOTS = LOG_SLOTS * 3 / 4; // flush early from here
+
+    struct slot_t {
+        std::atomic<uint32_t> seq; // 2 * ticket + 1 while written, 2 * ticket + 2 when committed
+        uint16_t len;
+        bool deferred; // text holds a binary record, see encode_record
+        char text[LOG_SLOT_SIZE];
+    };
+
+    slot_t slots_[LOG_SLOTS];
+    std::atomic<uint32_t> head_{0}; // next ticket
+    uint32_t tail_ = 0; // next ticket to send, consumer only
+    char send_buffer_[LOG_SEND_CHUNK];
+    char record_[LOG_SLOT_SIZE]; // consumer only, a deferred slot is copied out before it is formatted
+    char line_[LOG_LINE_MAX]; // consumer only
+    std::atomic<capture_mode_t> mode_{capture_mode_t::FORMAT_ONCE};
+    std::atomic<timestamp_t> timestamp_{timestamp_t::CALENDAR};
+
+    // calendar part of the prefix, formatted once a second - a seqlock, whoever sees a new second refreshes it
+    // readers copy it while a refresh may write, so every field is a relaxed atomic, the text word by word
+    // 32 bit seconds, 64 bit atomics are not lock-free on the esp32 and the cache only compares them
+    std::atomic<uint32_t> time_seq_{0};
+    std::atomic<uint32_t> time_sec_{UINT32_MAX};
+    std::atomic<uint8_t> time_len_{0};
+    std::atomic<uint32_t> time_words_[LOG_TIME_MAX / 4] = {};
+
+    std::atomic<uint32_t> captured_{0};
+    std::atomic<uint32_t> sent_{0};
+    std::atomic<uint32_t> dropped_{0};
+    std::atomic<uint32_t> busy_{0};
+    std::atomic<uint32_t> truncated_{0};
+    uint32_t reported_drops_ = 0; // consumer only
+    uint32_t stalled_at_ = UINT32_MAX; // consumer only, ticket we waited for last round
+    int64_t last_send_us_ = 0; // consumer only
+    std::atomic<bool> flushing_{false}; // one consumer at a time
 
-    // Thread safety
+    // serializes set_callback/detach_callback - neither producers nor the consumer take it
     SemaphoreHandle_t buffer_mutex_;
 
     // Timer for periodic sending
     esp_timer_handle_t log_timer_;
 
-    // Callback
-    LogSendCallback send_callback_;
+    // Callback - swapped atomically, the consumer calls its own reference outside any lock
+    std::shared_ptr<LogSendCallback> send_callback_;
     bool timer_initialized_;
-};
\ No newline at end of file
+};
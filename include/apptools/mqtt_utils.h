@@ -1,4 +1,6 @@
 #include "mqtt_client.h"
 #pragma once
 
-void mqtt_init_default(esp_mqtt_client_config_t *mqtt_config, const char *uri, int port);
+// MQTT_PROTOCOL_V_5 needs CONFIG_MQTT_PROTOCOL_5, ha_mqtt_handler falls back to 3.1.1 if the broker refuses it
+void mqtt_init_default(esp_mqtt_client_config_t *mqtt_config, const char *uri, int port,
+                       esp_mqtt_protocol_ver_t protocol = MQTT_PROTOCOL_V_3_1_1);
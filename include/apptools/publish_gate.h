@@ -0,0 +1,94 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <vector>
+#include "mqtt_client.h"
+#include <apptools/publish_telemetry.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+/*
+ * every outgoing publish passes here - the mqtt outbox is kept under a byte budget
+ * each priority may fill its share of the budget, logs go first, state is held back next and
+ * discovery (retained, kept in the discovery cache) is refused last and retried by its owner
+ * held back state messages collapse into one full state message once the outbox has drained
+ * on an mqtt 5 connection state topics get a topic alias and every priority its own message expiry
+ * an alias is sent with its topic once per connection and with an empty topic after that
+ */
+class publish_gate {
+public:
+    enum priority_t : uint8_t {
+        PRIORITY_DISCOVERY, // refused only over the whole budget
+        PRIORITY_STATE, // superseded by the next state message anyway
+        PRIORITY_LOG, // dropped first
+        PRIORITY_COUNT
+    };
+
+    struct stats_t {
+        uint32_t sent;
+        uint32_t coalesced; // state messages held back and replaced by a later full state
+        uint32_t dropped; // log chunks
+        uint32_t dropped_bytes;
+        uint32_t refused; // discovery, retried by the caller
+    };
+
+    publish_gate();
+    ~publish_gate();
+
+    void set_client(esp_mqtt_client_handle_t client) { client_ = client; }
+    // enqueue latency, bytes and client failures per priority
+    void set_telemetry(publish_telemetry *telemetry) { telemetry_ = telemetry; }
+    void set_budget(size_t bytes) { budget_ = bytes; }
+    inline size_t budget() const { return budget_; }
+    void set_connected(bool connected);
+
+    // only honoured while connected with mqtt 5, aliases are handed out to state topics first come first served
+    void set_mqtt5(bool on) { mqtt5_ = on; }
+    inline bool mqtt5() const { return mqtt5_; }
+    void set_topic_alias_max(uint16_t n) { alias_max_ = n; }
+    void set_message_expiry(priority_t priority, uint32_t seconds) { expiry_s_[priority] = seconds; }
+
+    // message id, -1 if the message was not handed to the client
+    int publish(const char *topic, const char *data, size_t len, int qos, int retain, priority_t priority);
+
+    // true once after state was held back and the outbox is down to half the state share again
+    bool take_recovered();
+
+    inline bool holding_state() const { return holding_state_; }
+    size_t outbox_size() const;
+    stats_t stats() const;
+
+private:
+    bool admit(size_t len, priority_t priority) const;
+    struct alias_t {
+        const char *topic; // interned
+        uint32_t connection; // the topic went out with the alias on this connection
+    };
+
+    uint16_t alias_for(const char *topic);
+
+    esp_mqtt_client_handle_t client_ = nullptr;
+    publish_telemetry *telemetry_ = nullptr;
+    size_t budget_ = 16384;
+    std::atomic<bool> connected_{false};
+    std::atomic<bool> holding_state_{false};
+
+    std::atomic<bool> mqtt5_{false};
+    uint16_t alias_max_ = 8;
+    uint32_t expiry_s_[PRIORITY_COUNT] = {};
+    // counted up on every connect without a lock - the mqtt task must not wait for mqtt5_mutex_,
+    // it is held across a publish that takes the client lock
+    std::atomic<uint32_t> connection_{0};
+    // the rest is guarded by mqtt5_mutex_
+    std::vector<alias_t> aliases_; // alias is index + 1
+    uint32_t alias_connection_ = 0;
+    uint16_t alias_limit_ = 0; // the broker may allow fewer than alias_max_, learned per connection
+    SemaphoreHandle_t mqtt5_mutex_; // publish properties are client wide until the next publish
+
+    std::atomic<uint32_t> sent_{0};
+    std::atomic<uint32_t> coalesced_{0};
+    std::atomic<uint32_t> dropped_{0};
+    std::atomic<uint32_t> dropped_bytes_{0};
+    std::atomic<uint32_t> refused_{0};
+};
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+
+struct governor_config_t {
+    bool enabled = false;
+    uint8_t cpu_busy_pct = 60; // sensor intervals start to stretch above this load
+    uint8_t cpu_saturated_pct = 90; // and are stretched all the way here
+    uint32_t heap_low_bytes = 48 * 1024;
+    uint32_t heap_critical_bytes = 16 * 1024;
+    uint8_t max_stretch = 8; // at most this many times a sensor's own interval
+};
+
+/*
+ * stretches publish intervals while the node is busy, short of memory or the outbox fills up
+ * backs off at once when pressure rises and tightens again step by step when it goes away
+ */
+class publish_governor {
+public:
+    void configure(const governor_config_t &config) {
+        config_ = config;
+        stretch_pct_ = 100;
+        pressure_pct_ = 0;
+    }
+
+    inline bool enabled() const { return config_.enabled; }
+
+    // cpu_pct < 0 means unknown, the worst of the three inputs decides
+    void update(float cpu_pct, uint32_t free_heap, uint32_t outbox_pct);
+
+    // min_ms stretched by the current pressure, never beyond max_ms (but never below min_ms either)
+    uint32_t interval_ms(uint32_t min_ms, uint32_t max_ms) const;
+
+    inline uint16_t stretch_pct() const { return stretch_pct_; } // 100 == as configured
+    inline uint8_t pressure_pct() const { return pressure_pct_; }
+    inline float cpu_load() const { return cpu_pct_; } // last sample handed to update()
+
+private:
+    governor_config_t config_;
+    uint16_t stretch_pct_ = 100;
+    uint8_t pressure_pct_ = 0;
+    float cpu_pct_ = -1;
+};
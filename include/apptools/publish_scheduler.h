@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <apptools/ha_discovery.h>
+
+/*
+ * min-heap of sensor deadlines - the publisher only polls the sensors that are due
+ * and sleeps until the earliest deadline in the heap
+ */
+class publish_scheduler {
+public:
+    static constexpr int16_t MAIN_DEVICE = -1;
+
+    struct entry_t {
+        int64_t deadline_ms;
+        ha_discovery::sensor_wrapper_t *sensor; // nullptr == built-in sensors
+        int16_t device; // MAIN_DEVICE or index of sub device
+        uint16_t slot; // registration order within the device
+    };
+
+    void clear() { heap_.clear(); }
+
+    inline bool empty() const { return heap_.empty(); }
+
+    inline size_t size() const { return heap_.size(); }
+
+    void push(const entry_t &entry);
+
+    // earliest deadline, INT64_MAX if nothing is scheduled
+    int64_t next_deadline_ms() const;
+
+    // moves all entries with deadline <= now_ms (or all if force) to due - sorted by device and slot
+    void pop_due(int64_t now_ms, bool force, std::vector<entry_t> &due);
+
+private:
+    std::vector<entry_t> heap_;
+};
@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * cheap counters and fixed bucket latency histograms for the publish paths
+ * recording is a handful of relaxed atomic increments, safe from any task
+ * bucket i counts samples below 16us << i, the last bucket takes everything slower
+ */
+class publish_telemetry {
+public:
+    static constexpr int BUCKETS = 14; // bounds 16us .. 65.5ms, the last one is open ended
+    static constexpr uint32_t FIRST_BUCKET_US = 16;
+
+    enum path_t : uint8_t {
+        PATH_STATE_BUILD, // polling the due sensors into one state payload
+        PATH_STATE, // enqueueing a state message
+        PATH_DISCOVERY,
+        PATH_LOGS,
+        PATH_COUNT
+    };
+
+    struct path_stats_t {
+        uint32_t messages;
+        uint32_t bytes;
+        uint32_t failures; // the mqtt client refused the message
+        uint32_t max_us;
+        uint32_t buckets[BUCKETS];
+
+        uint32_t samples() const;
+        // upper bound of the bucket holding the pct percentile, 0 without samples
+        uint32_t percentile_us(int pct) const;
+        // counters accumulated since an earlier copy, max_us is kept as is
+        path_stats_t since(const path_stats_t &before) const;
+    };
+
+    void record(path_t path, uint32_t us, size_t bytes, bool ok);
+    path_stats_t stats(path_t path) const;
+
+private:
+    struct counters_t {
+        std::atomic<uint32_t> messages{0};
+        std::atomic<uint32_t> bytes{0};
+        std::atomic<uint32_t> failures{0};
+        std::atomic<uint32_t> max_us{0};
+        std::atomic<uint32_t> buckets[BUCKETS] = {};
+    };
+
+    counters_t paths_[PATH_COUNT];
+};
@@ -0,0 +1,112 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/*
+ * read-mostly value published as immutable copies - rcu with epoch based reclamation
+ * readers pin the current copy with read(), lock free: one reader slot and two atomic loads
+ * writers copy, modify and publish - they must be serialized by the caller
+ * a replaced copy is freed by a later writer once no reader that could have seen it is left
+ */
+template<typename T>
+class snapshot {
+public:
+    static constexpr int MAX_READERS = 4; // concurrent readers, more spin until a slot is free
+
+    class guard {
+    public:
+        guard(const snapshot *owner, int slot, const T *value) : owner_(owner), slot_(slot), value_(value) {
+        }
+
+        guard(guard &&other) : owner_(other.owner_), slot_(other.slot_), value_(other.value_) {
+            other.owner_ = nullptr;
+        }
+
+        guard(const guard &) = delete;
+        guard &operator=(const guard &) = delete;
+
+        ~guard() {
+            if (owner_)
+                owner_->readers_[slot_].store(0);
+        }
+
+        inline const T *operator->() const { return value_; }
+        inline const T &operator*() const { return *value_; }
+
+    private:
+        const snapshot *owner_;
+        int slot_;
+        const T *value_;
+    };
+
+    snapshot() : current_(new T()) {
+        for (auto &reader : readers_)
+            reader.store(0);
+    }
+
+    ~snapshot() {
+        delete current_.load();
+        for (auto &retired : retired_)
+            delete retired.second;
+    }
+
+    snapshot(const snapshot &) = delete;
+    snapshot &operator=(const snapshot &) = delete;
+
+    guard read() const {
+        while (true) {
+            for (int i = 0; i < MAX_READERS; i++) {
+                // announce the epoch before loading the pointer - a writer seeing an idle slot
+                // has already swapped, so we can only get the new copy
+                uint32_t idle = 0;
+                if (readers_[i].compare_exchange_strong(idle, epoch_.load()))
+                    return guard(this, i, current_.load());
+            }
+            taskYIELD();
+        }
+    }
+
+    // writer side
+    inline const T &current() const { return *current_.load(); }
+
+    template<typename F>
+    void update(F modify) {
+        T *next = new T(*current_.load());
+        modify(*next);
+        T *old = current_.exchange(next);
+        // readers that entered up to this epoch may still hold old
+        retired_.emplace_back(epoch_.fetch_add(1), old);
+        reclaim();
+    }
+
+    void reclaim() {
+        uint32_t oldest = UINT32_MAX;
+        for (const auto &reader : readers_) {
+            uint32_t e = reader.load();
+            if (e != 0 && e < oldest)
+                oldest = e;
+        }
+
+        size_t kept = 0;
+        for (auto &retired : retired_) {
+            if (retired.first < oldest)
+                delete retired.second;
+            else
+                retired_[kept++] = retired;
+        }
+        retired_.resize(kept);
+    }
+
+    inline size_t retired() const { return retired_.size(); }
+
+private:
+    std::atomic<T *> current_;
+    std::atomic<uint32_t> epoch_{1}; // 0 marks an idle reader slot
+    mutable std::atomic<uint32_t> readers_[MAX_READERS];
+    std::vector<std::pair<uint32_t, T *> > retired_;
+};
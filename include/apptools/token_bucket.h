@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+
+/*
+ * token bucket holding at most one second of budget
+ * a request larger than the bucket is let through when the bucket is full and paid back as debt
+ */
+class token_bucket {
+public:
+    token_bucket(uint32_t rate_per_s = 1) {
+        set_rate(rate_per_s);
+    }
+
+    void set_rate(uint32_t rate_per_s) {
+        rate_ = rate_per_s > 0 ? rate_per_s : 1;
+        tokens_ = rate_;
+    }
+
+    void refill(int64_t now_ms) {
+        if (last_ms_ == 0 || now_ms < last_ms_) {
+            last_ms_ = now_ms;
+            return;
+        }
+        int64_t gained = (now_ms - last_ms_) * rate_ / 1000;
+        if (gained == 0)
+            return;
+        // only move the clock by what we actually converted to tokens
+        last_ms_ += gained * 1000 / rate_;
+        tokens_ += gained;
+        if (tokens_ > rate_)
+            tokens_ = rate_;
+    }
+
+    inline bool can_take(uint32_t n) const { return tokens_ >= (int64_t) n || tokens_ >= (int64_t) rate_; }
+
+    inline void take(uint32_t n) { tokens_ -= n; }
+
+    // time until can_take(n) becomes true
+    int64_t wait_ms(uint32_t n) const {
+        if (can_take(n))
+            return 0;
+        int64_t need = (n < rate_ ? n : rate_) - tokens_;
+        return (need * 1000 + rate_ - 1) / rate_;
+    }
+
+private:
+    uint32_t rate_;
+    int64_t tokens_;
+    int64_t last_ms_ = 0;
+};
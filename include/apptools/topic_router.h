@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/*
+ * exact match dispatch of incoming topics - routes are added at subscription time and sorted by hash,
+ * a lookup is a hash of the topic bytes and a binary search, no copies and no heap
+ * not thread safe, the owner serializes registration against dispatch
+ */
+class topic_router {
+public:
+    using handler_t = std::function<void(const char *data, int data_len)>;
+    // large messages fragment by fragment as the client receives them, offset + data_len == total_len on the last one
+    using chunk_handler_t = std::function<void(const char *data, int data_len, int offset, int total_len)>;
+
+    struct route_t {
+        uint32_t hash;
+        uint16_t topic_len;
+        const char *topic;
+        handler_t handler;
+        chunk_handler_t chunk_handler; // set for chunked routes instead of handler
+    };
+
+    // topic must outlive the router (interned), a second route for the same topic replaces the first
+    void add(const char *topic, handler_t handler);
+    void add_chunked(const char *topic, chunk_handler_t handler);
+
+    const route_t *find(const char *topic, int topic_len) const;
+
+    // false if nothing is routed to the topic
+    bool dispatch(const char *topic, int topic_len, const char *data, int data_len) const;
+
+    inline size_t size() const { return routes_.size(); }
+
+private:
+    route_t &insert(const char *topic);
+
+    std::vector<route_t> routes_;
+};
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * interned topic strings - formatted once at registration, the pointers stay valid for the lifetime of the table
+ * strings are packed into fixed blocks so the table does not fragment the heap
+ * not thread safe, the owner serializes access
+ */
+class topic_table {
+public:
+    topic_table() = default;
+    ~topic_table();
+
+    topic_table(const topic_table &) = delete;
+    topic_table &operator=(const topic_table &) = delete;
+
+    // returns the existing copy if the topic was interned before, nullptr if out of memory
+    const char *intern(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+    inline size_t count() const { return entries_.size(); }
+
+    // bytes allocated for blocks and the index
+    size_t footprint() const;
+
+private:
+    static constexpr size_t BLOCK_SIZE = 512;
+
+    struct entry_t {
+        uint32_t hash;
+        const char *str;
+    };
+
+    char *allocate(size_t len);
+
+    std::vector<char *> blocks_;
+    size_t blocks_bytes_ = 0;
+    size_t block_used_ = BLOCK_SIZE;
+    std::vector<entry_t> entries_;
+};
@@ -0,0 +1,232 @@
+#include <apptools/json_writer.h>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+static const char HEX[] = "0123456789abcdef";
+static const uint32_t POW10[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+bool json_writer::put(char c) {
+    if (len_ + 1 > size_)
+        return false;
+    buffer_[len_++] = c;
+    return true;
+}
+
+bool json_writer::put(const char *s, size_t n) {
+    if (len_ + n > size_)
+        return false;
+    memcpy(buffer_ + len_, s, n);
+    len_ += n;
+    return true;
+}
+
+bool json_writer::put_escaped(const char *s, size_t max_len) {
+    for (size_t i = 0; i < max_len && s[i]; i++) {
+        unsigned char c = s[i];
+        bool ok;
+        switch (c) {
+            case '"': ok = put("\\\"", 2); break;
+            case '\\': ok = put("\\\\", 2); break;
+            case '\n': ok = put("\\n", 2); break;
+            case '\r': ok = put("\\r", 2); break;
+            case '\t': ok = put("\\t", 2); break;
+            default:
+                if (c < 0x20) {
+                    char esc[6] = {'\\', 'u', '0', '0', HEX[c >> 4], HEX[c & 0xf]};
+                    ok = put(esc, sizeof(esc));
+                } else {
+                    ok = put((char) c);
+                }
+                break;
+        }
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+bool json_writer::put_uint(uint64_t v) {
+    char tmp[20];
+    int n = 0;
+    do {
+        tmp[n++] = (char) ('0' + v % 10);
+        v /= 10;
+    } while (v);
+
+    if (len_ + n > size_)
+        return false;
+    while (n)
+        buffer_[len_++] = tmp[--n];
+    return true;
+}
+
+bool json_writer::separator() {
+    if (after_key_) {
+        after_key_ = false;
+        return true;
+    }
+    if (depth_ == 0)
+        return true;
+
+    uint32_t bit = 1u << depth_;
+    if (first_ & bit) {
+        first_ &= ~bit;
+        return true;
+    }
+    return put(',');
+}
+
+json_writer &json_writer::fail(const mark_t &m) {
+    rollback(m);
+    dropped_++;
+    return *this;
+}
+
+void json_writer::rollback(const mark_t &m) {
+    len_ = m.len;
+    first_ = m.first;
+    depth_ = m.depth;
+    after_key_ = m.after_key;
+}
+
+json_writer &json_writer::begin_object(const char *k) {
+    mark_t m = mark();
+    if (depth_ >= 31 || (k && !key(k).after_key_) || !separator() || !put('{'))
+        return fail(m);
+    depth_++;
+    first_ |= 1u << depth_;
+    return *this;
+}
+
+json_writer &json_writer::end_object() {
+    mark_t m = mark();
+    if (depth_ == 0 || !put('}'))
+        return fail(m);
+    depth_--;
+    return *this;
+}
+
+json_writer &json_writer::begin_array(const char *k) {
+    mark_t m = mark();
+    if (depth_ >= 31 || (k && !key(k).after_key_) || !separator() || !put('['))
+        return fail(m);
+    depth_++;
+    first_ |= 1u << depth_;
+    return *this;
+}
+
+json_writer &json_writer::end_array() {
+    mark_t m = mark();
+    if (depth_ == 0 || !put(']'))
+        return fail(m);
+    depth_--;
+    return *this;
+}
+
+json_writer &json_writer::key(const char *k) {
+    mark_t m = mark();
+    if (!separator() || !put('"') || !put_escaped(k, SIZE_MAX) || !put("\":", 2))
+        return fail(m);
+    after_key_ = true;
+    return *this;
+}
+
+json_writer &json_writer::value(const char *str) {
+    if (!str)
+        return null();
+    mark_t m = mark();
+    if (!separator() || !put('"') || !put_escaped(str, SIZE_MAX) || !put('"'))
+        return fail(m);
+    return *this;
+}
+
+json_writer &json_writer::value(bool v) {
+    mark_t m = mark();
+    if (!separator() || !(v ? put("true", 4) : put("false", 5)))
+        return fail(m);
+    return *this;
+}
+
+json_writer &json_writer::null() {
+    mark_t m = mark();
+    if (!separator() || !put("null", 4))
+        return fail(m);
+    return *this;
+}
+
+json_writer &json_writer::value_int(int64_t v) {
+    mark_t m = mark();
+    if (!separator() || (v < 0 && !put('-')) || !put_uint(v < 0 ? 0 - (uint64_t) v : (uint64_t) v))
+        return fail(m);
+    return *this;
+}
+
+json_writer &json_writer::value(double v, int decimals) {
+    if (!std::isfinite(v))
+        return null();
+
+    if (decimals < 0)
+        decimals = 0;
+    if (decimals > 9)
+        decimals = 9;
+
+    mark_t m = mark();
+    if (!separator())
+        return fail(m);
+
+    uint32_t scale = POW10[decimals];
+    double scaled = fabs(v) * scale + 0.5;
+    if (scaled >= 9.0e15) {
+        // out of range for the integer path - let printf deal with it
+        char tmp[32];
+        int n = snprintf(tmp, sizeof(tmp), "%.*e", decimals, v);
+        if (n < 0 || (size_t) n >= sizeof(tmp) || !put(tmp, n))
+            return fail(m);
+        return *this;
+    }
+
+    uint64_t fixed = (uint64_t) scaled;
+    if (fixed != 0 && v < 0 && !put('-'))
+        return fail(m);
+    if (!put_uint(fixed / scale))
+        return fail(m);
+
+    if (decimals > 0) {
+        if (len_ + 1 + decimals > size_)
+            return fail(m);
+        buffer_[len_++] = '.';
+        uint32_t frac = fixed % scale;
+        for (int i = decimals - 1; i >= 0; i--) {
+            buffer_[len_ + i] = (char) ('0' + frac % 10);
+            frac /= 10;
+        }
+        len_ += decimals;
+    }
+    return *this;
+}
+
+json_writer &json_writer::string_begin(const char *k) {
+    string_mark_ = mark();
+    string_failed_ = (k && !key(k).after_key_) || !separator() || !put('"');
+    return *this;
+}
+
+json_writer &json_writer::string_append(const char *str, size_t max_len) {
+    if (!string_failed_ && str)
+        string_failed_ = !put_escaped(str, max_len);
+    return *this;
+}
+
+json_writer &json_writer::string_end() {
+    if (string_failed_ || !put('"'))
+        return fail(string_mark_);
+    return *this;
+}
+
+json_writer &json_writer::raw(const char *json, size_t len) {
+    mark_t m = mark();
+    if (!separator() || !put(json, len))
+        return fail(m);
+    return *this;
+}
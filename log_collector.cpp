@@ -6,6 +6,7 @@
 #include <sys/time.h>
 
 #define LOG_SEND_INTERVAL_US 10000000  // 10 seconds in microseconds
+#define LOG_CHECK_INTERVAL_US 500000 // how often we look at the high water mark
 
 // Static instance initialization - happens before main()
 LogCollector LogCollector::instance_;
@@ -15,11 +16,14 @@ LogCollector& LogCollector::instance() {
 }
 
 LogCollector::LogCollector()
-    : log_buffer_pos_(0)
-    , buffer_mutex_(nullptr)
+    : buffer_mutex_(nullptr)
     , log_timer_(nullptr)
     , timer_initialized_(false) {
 
+    for (size_t i = 0; i < LOG_SLOTS; i++) {
+        slots_[i].seq.store(0, std::memory_order_relaxed);
+    }
+
     // Create mutex early
     buffer_mutex_ = xSemaphoreCreateMutex();
 
@@ -33,7 +37,7 @@ bool LogCollector::initialize_timer() {
     }
 
     esp_timer_create_args_t log_timer_args = {
-        .callback = &send_logs_wrapper,
+        .callback = &check_flush_wrapper,
         .arg = this,
         .name = "log_timer"
     };
@@ -42,7 +46,7 @@ bool LogCollector::initialize_timer() {
         return false;
     }
 
-    if (esp_timer_start_periodic(log_timer_, LOG_SEND_INTERVAL_US) != ESP_OK) {
+    if (esp_timer_start_periodic(log_timer_, LOG_CHECK_INTERVAL_US) != ESP_OK) {
         esp_timer_delete(log_timer_);
         return false;
     }
@@ -56,7 +60,7 @@ void LogCollector::set_callback(LogSendCallback callback) {
         xSemaphoreTake(buffer_mutex_, portMAX_DELAY);
     }
 
-    send_callback_ = callback;
+    std::atomic_store(&send_callback_, std::make_shared<LogSendCallback>(callback));
 
     // Initialize timer if this is the first callback set
     if (!timer_initialized_) {
@@ -73,23 +77,355 @@ void LogCollector::detach_callback() {
         xSemaphoreTake(buffer_mutex_, portMAX_DELAY);
     }
 
-    send_callback_ = nullptr;
+    std::atomic_store(&send_callback_, std::shared_ptr<LogSendCallback>());
 
     if (buffer_mutex_) {
         xSemaphoreGive(buffer_mutex_);
     }
+
+    // the owner of the callback may go away once we return
+    // seq_cst pairs with send_logs: it sets flushing_ then loads the callback, we clear the callback then load
+    // flushing_ - at least one of us sees the other's write
+    while (flushing_.load(std::memory_order_seq_cst)) {
+        vTaskDelay(1);
+    }
+}
+
+void LogCollector::capture_time(struct timeval &tv) const {
+    if (timestamp_.load(std::memory_order_relaxed) == timestamp_t::MONOTONIC_MS) {
+        int64_t now = esp_timer_get_time();
+        tv.tv_sec = (time_t) (now / 1000000);
+        tv.tv_usec = (suseconds_t) (now % 1000000);
+    } else {
+        gettimeofday(&tv, NULL);
+    }
+}
+
+static size_t put_uint(char *out, uint64_t v) {
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[n++] = (char) ('0' + v % 10);
+        v /= 10;
+    } while (v);
+    for (size_t i = 0; i < n; i++)
+        out[i] = digits[n - 1 - i];
+    return n;
+}
+
+// out has room for LOG_TIME_MAX, returns the length without the terminator
+size_t LogCollector::format_time(const struct timeval &tv, char *out) {
+    size_t len;
+    if (timestamp_.load(std::memory_order_relaxed) != timestamp_t::CALENDAR) {
+        len = put_uint(out, (uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000);
+        out[len] = '\0';
+        return len;
+    }
+
+    uint32_t seq = time_seq_.load(std::memory_order_acquire);
+    bool cached = !(seq & 1) && time_sec_.load(std::memory_order_relaxed) == (uint32_t) tv.tv_sec;
+    if (cached) {
+        uint32_t words[LOG_TIME_MAX / 4];
+        len = time_len_.load(std::memory_order_relaxed);
+        if (len >= LOG_TIME_MAX - 4)
+            len = 0;
+        for (size_t i = 0; i < (len + 3) / 4; i++)
+            words[i] = time_words_[i].load(std::memory_order_relaxed);
+        memcpy(out, words, len);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        cached = time_seq_.load(std::memory_order_relaxed) == seq;
+    }
+    if (!cached) {
+        struct tm timeinfo;
+        time_t sec = tv.tv_sec;
+        localtime_r(&sec, &timeinfo);
+        len = strftime(out, LOG_TIME_MAX - 4, "%Y-%m-%d %H:%M:%S", &timeinfo);
+        // another thread refreshing it wins, we just do not cache this time
+        if (!(seq & 1) && time_seq_.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire)) {
+            uint32_t words[LOG_TIME_MAX / 4] = {};
+            memcpy(words, out, len);
+            for (size_t i = 0; i < (len + 3) / 4; i++)
+                time_words_[i].store(words[i], std::memory_order_relaxed);
+            time_len_.store((uint8_t) len, std::memory_order_relaxed);
+            time_sec_.store((uint32_t) tv.tv_sec, std::memory_order_relaxed);
+            time_seq_.store(seq + 2, std::memory_order_release);
+        }
+    }
+
+    int ms = (int) (tv.tv_usec / 1000);
+    out[len++] = '.';
+    out[len++] = (char) ('0' + ms / 100);
+    out[len++] = (char) ('0' + ms / 10 % 10);
+    out[len++] = (char) ('0' + ms % 10);
+    out[len] = '\0';
+    return len;
 }
 
-static void get_current_time(char* time_str, size_t max_len) {
+size_t LogCollector::timestamp_prefix(char *out) {
     struct timeval tv;
-    struct tm timeinfo;
-    gettimeofday(&tv, NULL);
-    localtime_r(&tv.tv_sec, &timeinfo);
-    strftime(time_str, max_len, "%Y-%m-%d %H:%M:%S", &timeinfo);
+    capture_time(tv);
+    return format_time(tv, out);
+}
+
+/*
+ * deferred lines are stored as a binary record instead of text:
+ *   int64 seconds, int32 microseconds, the format string pointer, then every argument in its native type,
+ *   strings are copied with their terminator
+ * the format string is walked again at send time to know what to read back
+ */
+enum class arg_t : uint8_t { NONE, INT, LONG, LLONG, SIZE, PTRDIFF, DOUBLE, STR, PTR, UNSUPPORTED };
+
+struct spec_t {
+    const char *start; // the '%'
+    size_t len;
+    int stars; // '*' width and precision, each an int argument before the value
+    int precision; // -1 if none or '*'
+    arg_t type;
+};
+
+#define LOG_SPEC_MAX 16 // "%-+ #0123.456lld" is plenty
+
+// the next conversion at or after p, spec.start is nullptr at the end of the format string
+static const char *next_spec(const char *p, spec_t &spec) {
+    spec = {nullptr, 0, 0, -1, arg_t::NONE};
+    while (*p && *p != '%')
+        p++;
+    if (!*p)
+        return p;
+    spec.start = p++;
+    while (*p && strchr("-+ #0", *p))
+        p++;
+    if (*p == '*') {
+        spec.stars++;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9')
+        p++;
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec.stars++;
+            p++;
+        } else {
+            spec.precision = 0;
+            while (*p >= '0' && *p <= '9')
+                spec.precision = spec.precision * 10 + (*p++ - '0');
+        }
+    }
+    arg_t integer = arg_t::INT;
+    if (*p == 'h') {
+        p += p[1] == 'h' ? 2 : 1; // promoted to int
+    } else if (*p == 'l') {
+        integer = p[1] == 'l' ? arg_t::LLONG : arg_t::LONG;
+        p += p[1] == 'l' ? 2 : 1;
+    } else if (*p == 'j') {
+        integer = arg_t::LLONG;
+        p++;
+    } else if (*p == 'z') {
+        integer = arg_t::SIZE;
+        p++;
+    } else if (*p == 't') {
+        integer = arg_t::PTRDIFF;
+        p++;
+    } else if (*p == 'L') {
+        integer = arg_t::UNSUPPORTED; // long double
+        p++;
+    }
+    switch (*p) {
+    case '%':
+        spec.type = arg_t::NONE;
+        break;
+    case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+        spec.type = integer;
+        break;
+    case 'c':
+        spec.type = integer == arg_t::INT ? arg_t::INT : arg_t::UNSUPPORTED; // %lc is a wide char
+        break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        spec.type = integer == arg_t::UNSUPPORTED ? arg_t::UNSUPPORTED : arg_t::DOUBLE;
+        break;
+    case 's':
+        spec.type = integer == arg_t::INT ? arg_t::STR : arg_t::UNSUPPORTED; // %ls is a wchar_t string
+        break;
+    case 'p':
+        spec.type = arg_t::PTR;
+        break;
+    default:
+        spec.type = arg_t::UNSUPPORTED; // %n, a truncated format
+        break;
+    }
+    if (*p)
+        p++;
+    spec.len = p - spec.start;
+    if (spec.len >= LOG_SPEC_MAX)
+        spec.type = arg_t::UNSUPPORTED;
+    return p;
+}
+
+template<typename T>
+static bool put(char *record, size_t size, size_t &len, const T &v) {
+    if (len + sizeof(T) > size)
+        return false;
+    memcpy(record + len, &v, sizeof(T));
+    len += sizeof(T);
+    return true;
+}
+
+template<typename T>
+static bool take(const char *record, size_t size, size_t &pos, T &v) {
+    if (pos + sizeof(T) > size)
+        return false;
+    memcpy(&v, record + pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+}
+
+// false if the line can not be deferred - it does not fit or uses a conversion we do not know
+static bool encode_record(char *record, size_t size, uint16_t &record_len,
+                          const struct timeval &tv, const char *fmt, va_list args) {
+    size_t len = 0;
+    if (!put(record, size, len, (int64_t) tv.tv_sec) ||
+        !put(record, size, len, (int32_t) tv.tv_usec) ||
+        !put(record, size, len, fmt))
+        return false;
+
+    spec_t spec;
+    for (const char *p = next_spec(fmt, spec); spec.start; p = next_spec(p, spec)) {
+        int precision = spec.precision;
+        for (int i = 0; i < spec.stars; i++) {
+            int star = va_arg(args, int);
+            if (!put(record, size, len, star))
+                return false;
+            // only the last '*' can be the precision
+            if (i == spec.stars - 1 && memchr(spec.start, '.', spec.len))
+                precision = star;
+        }
+        bool ok = true;
+        switch (spec.type) {
+        case arg_t::NONE: break;
+        case arg_t::INT: ok = put(record, size, len, va_arg(args, int)); break;
+        case arg_t::LONG: ok = put(record, size, len, va_arg(args, long)); break;
+        case arg_t::LLONG: ok = put(record, size, len, va_arg(args, long long)); break;
+        case arg_t::SIZE: ok = put(record, size, len, va_arg(args, size_t)); break;
+        case arg_t::PTRDIFF: ok = put(record, size, len, va_arg(args, ptrdiff_t)); break;
+        case arg_t::DOUBLE: ok = put(record, size, len, va_arg(args, double)); break;
+        case arg_t::PTR: ok = put(record, size, len, va_arg(args, void *)); break;
+        case arg_t::STR: {
+            const char *str = va_arg(args, const char *);
+            if (!str)
+                str = "(null)";
+            // a precision bounds the read, the string need not be terminated then
+            size_t n = precision >= 0 ? strnlen(str, precision) : strlen(str);
+            ok = len + n + 1 <= size;
+            if (ok) {
+                memcpy(record + len, str, n);
+                record[len + n] = '\0';
+                len += n + 1;
+            }
+            break;
+        }
+        case arg_t::UNSUPPORTED: ok = false; break;
+        }
+        if (!ok)
+            return false;
+    }
+    record_len = len;
+    return true;
+}
+
+template<typename T>
+static int format_arg(char *out, size_t size, const char *spec, const int *stars, int nstars, T v) {
+    switch (nstars) {
+    case 0: return snprintf(out, size, spec, v);
+    case 1: return snprintf(out, size, spec, stars[0], v);
+    default: return snprintf(out, size, spec, stars[0], stars[1], v);
+    }
+}
+
+// when a record written by encode_record was captured
+static bool record_time(const char *record, size_t record_len, struct timeval &tv) {
+    int64_t sec;
+    int32_t usec;
+    size_t pos = 0;
+    if (!take(record, record_len, pos, sec) || !take(record, record_len, pos, usec))
+        return false;
+    tv.tv_sec = (time_t) sec;
+    tv.tv_usec = usec;
+    return true;
+}
+
+// formats a record written by encode_record after the len bytes already in out,
+// returns the length without the terminator (at most size - 1)
+static size_t decode_record(const char *record, size_t record_len, char *out, size_t size, size_t len, bool &truncated) {
+    const char *fmt;
+    size_t pos = sizeof(int64_t) + sizeof(int32_t);
+    truncated = false;
+    if (!take(record, record_len, pos, fmt)) {
+        out[len] = '\0';
+        return len;
+    }
+
+    spec_t spec;
+    const char *p = fmt;
+    for (const char *next = next_spec(p, spec); ; next = next_spec(p, spec)) {
+        // literal text up to the conversion
+        size_t literal = (spec.start ? spec.start : next) - p;
+        if (len + literal >= size) {
+            literal = size - 1 - len;
+            truncated = true;
+        }
+        memcpy(out + len, p, literal);
+        len += literal;
+        if (!spec.start || truncated)
+            break;
+        p = next;
+
+        char conversion[LOG_SPEC_MAX];
+        memcpy(conversion, spec.start, spec.len);
+        conversion[spec.len] = '\0';
+        int stars[2] = {};
+        for (int i = 0; i < spec.stars; i++) {
+            if (!take(record, record_len, pos, stars[i]))
+                return len;
+        }
 
-    char ms_str[10];
-    snprintf(ms_str, sizeof(ms_str), ".%03d", (int)(tv.tv_usec / 1000));
-    strncat(time_str, ms_str, max_len - strlen(time_str) - 1);
+        char *dst = out + len;
+        size_t room = size - len;
+        int n = 0;
+        bool ok = true;
+        switch (spec.type) {
+        case arg_t::NONE: n = snprintf(dst, room, "%%"); break;
+        case arg_t::INT: { int v; ok = take(record, record_len, pos, v); if (ok) n = format_arg(dst, room, conversion, stars, spec.stars, v); break; }
+        case arg_t::LONG: { long v; ok = take(record, record_len, pos, v); if (ok) n = format_arg(dst, room, conversion, stars, spec.stars, v); break; }
+        case arg_t::LLONG: { long long v; ok = take(record, record_len, pos, v); if (ok) n = format_arg(dst, room, conversion, stars, spec.stars, v); break; }
+        case arg_t::SIZE: { size_t v; ok = take(record, record_len, pos, v); if (ok) n = format_arg(dst, room, conversion, stars, spec.stars, v); break; }
+        case arg_t::PTRDIFF: { ptrdiff_t v; ok = take(record, record_len, pos, v); if (ok) n = format_arg(dst, room, conversion, stars, spec.stars, v); break; }
+        case arg_t::DOUBLE: { double v; ok = take(record, record_len, pos, v); if (ok) n = format_arg(dst, room, conversion, stars, spec.stars, v); break; }
+        case arg_t::PTR: { void *v; ok = take(record, record_len, pos, v); if (ok) n = format_arg(dst, room, conversion, stars, spec.stars, v); break; }
+        case arg_t::STR: {
+            const char *v = record + pos;
+            size_t max = record_len - pos;
+            size_t slen = strnlen(v, max);
+            ok = slen < max;
+            if (ok) {
+                pos += slen + 1;
+                n = format_arg(dst, room, conversion, stars, spec.stars, v);
+            }
+            break;
+        }
+        case arg_t::UNSUPPORTED: ok = false; break;
+        }
+        if (!ok || n < 0)
+            return len;
+        if ((size_t) n >= room) {
+            len = size - 1;
+            truncated = true;
+            break;
+        }
+        len += n;
+    }
+    out[len] = '\0';
+    return len;
 }
 
 int LogCollector::log_vprintf_wrapper(const char *fmt, va_list args) {
@@ -97,66 +433,189 @@ int LogCollector::log_vprintf_wrapper(const char *fmt, va_list args) {
 }
 
 int LogCollector::log_vprintf(const char *fmt, va_list args) {
-    // First, print to stdout for immediate debug visibility
-    int stdout_ret = vprintf(fmt, args);
-
-    // Now handle buffering
-    int ret = 0;
-    if (buffer_mutex_ && xSemaphoreTake(buffer_mutex_, pdMS_TO_TICKS(100)) == pdTRUE) {
-        char time_str[32];
-        get_current_time(time_str, sizeof(time_str));
-
-        // Try to add timestamp
-        int time_len = snprintf(log_buffer_ + log_buffer_pos_,
-                              LOG_BUFFER_SIZE - log_buffer_pos_,
-                              "%s ", time_str);
-
-        if (time_len > 0) {
-            log_buffer_pos_ += time_len;
-
-            // Try to add log message
-            va_list args_copy;
-            va_copy(args_copy, args);
-            ret = vsnprintf(log_buffer_ + log_buffer_pos_,
-                          LOG_BUFFER_SIZE - log_buffer_pos_,
-                          fmt, args_copy);
-            va_end(args_copy);
-
-            if (ret >= 0) {
-                // Advance position only by what actually fit
-                size_t space_left = LOG_BUFFER_SIZE - log_buffer_pos_ - 1;
-                log_buffer_pos_ += (ret > space_left) ? space_left : ret;
-
-                // Add newline if there's space
-                if (log_buffer_pos_ < LOG_BUFFER_SIZE - 1) {
-                    log_buffer_[log_buffer_pos_++] = '\n';
-                }
-            }
+    capture_mode_t mode = mode_.load(std::memory_order_relaxed);
+
+    // never blocks - a slot still being written one lap behind costs us this line
+    uint32_t ticket = head_.fetch_add(1, std::memory_order_relaxed);
+    slot_t &slot = slots_[ticket % LOG_SLOTS];
+    uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+    if ((seq & 1) || (int32_t) (seq - 2 * ticket) > 0 ||
+        !slot.seq.compare_exchange_strong(seq, 2 * ticket + 1, std::memory_order_acquire)) {
+        busy_.fetch_add(1, std::memory_order_relaxed);
+        return mode == capture_mode_t::DEFERRED ? 0 : vprintf(fmt, args);
+    }
+
+    struct timeval tv;
+    capture_time(tv);
+
+    // either path may give up half way, both get their own copy
+    va_list args_copy;
+    va_copy(args_copy, args);
+    bool deferred = mode == capture_mode_t::DEFERRED &&
+        encode_record(slot.text, LOG_SLOT_SIZE, slot.len, tv, fmt, args_copy);
+    va_end(args_copy);
+    slot.deferred = deferred;
+    if (deferred) {
+        slot.seq.store(2 * ticket + 2, std::memory_order_release);
+        captured_.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+
+    int len = format_time(tv, slot.text);
+    slot.text[len++] = ' ';
+
+    va_copy(args_copy, args);
+    int ret = vsnprintf(slot.text + len, LOG_SLOT_SIZE - len, fmt, args_copy);
+    va_end(args_copy);
+
+    // the line is formatted once - stdout gets the same bytes, unless it did not fit the slot
+    int stdout_ret = 0;
+    bool whole = ret >= 0 && ret < (int) LOG_SLOT_SIZE - len;
+    if (mode == capture_mode_t::FORMAT_ONCE) {
+        stdout_ret = whole ? (int) fwrite(slot.text + len, 1, ret, stdout) : vprintf(fmt, args);
+    }
+
+    if (ret > 0) {
+        // Advance only by what actually fit, keep the last byte for the newline
+        int space_left = LOG_SLOT_SIZE - len - 1;
+        if (ret > space_left) {
+            truncated_.fetch_add(1, std::memory_order_relaxed);
+            ret = space_left;
         }
-        xSemaphoreGive(buffer_mutex_);
+        len += ret;
     }
+    // esp log lines end in a newline already, keep one line per slot
+    if (len == 0 || slot.text[len - 1] != '\n')
+        slot.text[len++] = '\n';
+    slot.len = len;
+
+    slot.seq.store(2 * ticket + 2, std::memory_order_release);
+    captured_.fetch_add(1, std::memory_order_relaxed);
 
     // Return stdout result to maintain compatibility
     return stdout_ret;
 }
 
-void LogCollector::send_logs_wrapper(void* arg) {
-    static_cast<LogCollector*>(arg)->send_logs();
+void LogCollector::check_flush_wrapper(void* arg) {
+    static_cast<LogCollector*>(arg)->check_flush();
+}
+
+// every LOG_SEND_INTERVAL_US, or earlier when the ring fills up
+void LogCollector::check_flush() {
+    uint32_t pending = head_.load(std::memory_order_relaxed) - tail_;
+    if (pending >= LOG_HIGH_WATER_SLOTS || esp_timer_get_time() - last_send_us_ >= LOG_SEND_INTERVAL_US) {
+        send_logs();
+    }
+}
+
+void LogCollector::flush_chunk(const LogSendCallback &callback, size_t &len) {
+    if (len > 0) {
+        callback(send_buffer_, len);
+        len = 0;
+    }
 }
 
 void LogCollector::send_logs() {
-    if (!buffer_mutex_ || !send_callback_) return;
-
-    if (xSemaphoreTake(buffer_mutex_, pdMS_TO_TICKS(100)) == pdTRUE) {
-        if (log_buffer_pos_ > 0) {
-            if (send_callback_) {
-                // todo maybe add return value here to allow for not clearing buffer on reconnects
-                send_callback_(log_buffer_, log_buffer_pos_);
-                log_buffer_pos_ = 0;
+    if (flushing_.exchange(true, std::memory_order_seq_cst))
+        return;
+
+    // our own reference - detach/set_callback do not wait for the publish and producers never do
+    std::shared_ptr<LogSendCallback> callback = std::atomic_load(&send_callback_);
+    if (callback) {
+        size_t len = 0;
+        uint32_t head = head_.load(std::memory_order_acquire);
+
+        // more than a lap behind - the oldest are gone already
+        if (head - tail_ > LOG_SLOTS) {
+            dropped_.fetch_add(head - tail_ - LOG_SLOTS, std::memory_order_relaxed);
+            tail_ = head - LOG_SLOTS;
+        }
+
+        for (; tail_ != head; tail_++) {
+            slot_t &slot = slots_[tail_ % LOG_SLOTS];
+            uint32_t committed = 2 * tail_ + 2;
+            uint32_t seq = slot.seq.load(std::memory_order_acquire);
+            if ((int32_t) (seq - committed) < 0) {
+                // still being written - or the producer lost the slot and it never will be,
+                // we only step over it if it is still not there on the next round
+                if (seq + 1 == committed || stalled_at_ != tail_) {
+                    stalled_at_ = tail_;
+                    break;
+                }
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            // claimed like a producer claims it - one a lap ahead finds it busy instead of writing under our copy
+            if (seq != committed || !slot.seq.compare_exchange_strong(seq, committed + 1, std::memory_order_acquire)) {
+                dropped_.fetch_add(1, std::memory_order_relaxed); // overwritten by a newer line
+                continue;
             }
+
+            size_t n = slot.len;
+            if (n > LOG_SLOT_SIZE)
+                n = LOG_SLOT_SIZE;
+            bool deferred = slot.deferred;
+            if (!deferred && len + n > LOG_SEND_CHUNK && len > 0) {
+                // not while we hold the slot, the callback publishes - then the same slot again
+                slot.seq.store(committed, std::memory_order_release);
+                flush_chunk(*callback, len);
+                tail_--;
+                continue;
+            }
+            memcpy(deferred ? record_ : send_buffer_ + len, slot.text, n);
+            slot.seq.store(committed, std::memory_order_release);
+
+            if (deferred) {
+                // only formatted from our own copy, the record is known to be whole now
+                struct timeval tv = {};
+                size_t line_len = 0;
+                if (record_time(record_, n, tv)) {
+                    line_len = format_time(tv, line_);
+                    line_[line_len++] = ' ';
+                }
+                bool truncated;
+                line_len = decode_record(record_, n, line_, LOG_LINE_MAX - 1, line_len, truncated);
+                if (truncated)
+                    truncated_.fetch_add(1, std::memory_order_relaxed);
+                if (line_len == 0 || line_[line_len - 1] != '\n')
+                    line_[line_len++] = '\n';
+                if (len + line_len > LOG_SEND_CHUNK)
+                    flush_chunk(*callback, len);
+                memcpy(send_buffer_ + len, line_, line_len);
+                n = line_len;
+            }
+            len += n;
+            sent_.fetch_add(1, std::memory_order_relaxed);
         }
-        xSemaphoreGive(buffer_mutex_);
+
+        // tell the reader what is missing
+        uint32_t drops = dropped_.load(std::memory_order_relaxed);
+        if (drops != reported_drops_) {
+            char note[64];
+            int n = snprintf(note, sizeof(note), "[log collector dropped %u lines]\n", (unsigned) (drops - reported_drops_));
+            if (n > 0 && (size_t) n < sizeof(note)) {
+                if (len + n > LOG_SEND_CHUNK)
+                    flush_chunk(*callback, len);
+                memcpy(send_buffer_ + len, note, n);
+                len += n;
+            }
+            reported_drops_ = drops;
+        }
+        // todo maybe add return value here to allow for not dropping logs on reconnects
+        flush_chunk(*callback, len);
     }
+    last_send_us_ = esp_timer_get_time();
+    flushing_.store(false, std::memory_order_release);
+}
+
+LogCollector::stats_t LogCollector::stats() const {
+    return {
+        captured_.load(std::memory_order_relaxed),
+        sent_.load(std::memory_order_relaxed),
+        dropped_.load(std::memory_order_relaxed),
+        busy_.load(std::memory_order_relaxed),
+        truncated_.load(std::memory_order_relaxed)
+    };
 }
 
 LogCollector::~LogCollector() {
@@ -1,6 +1,6 @@
 #include <apptools/mqtt_utils.h>
 
-void mqtt_init_default(esp_mqtt_client_config_t* mqtt_config, const char* uri, int port)
+void mqtt_init_default(esp_mqtt_client_config_t* mqtt_config, const char* uri, int port, esp_mqtt_protocol_ver_t protocol)
 {
     if (mqtt_config == nullptr)
     {
@@ -18,7 +18,11 @@ void mqtt_init_default(esp_mqtt_client_config_t* mqtt_config, const char* uri, i
     //mqtt_config->broker.address.transport = MQTT_TRANSPORT_OVER_TCP;
 
     mqtt_config->session.keepalive = 120; // 2 minutes
+#if CONFIG_MQTT_PROTOCOL_5
+    mqtt_config->session.protocol_ver = protocol;
+#else
     mqtt_config->session.protocol_ver = MQTT_PROTOCOL_V_3_1_1;
+#endif
     mqtt_config->session.last_will.qos = 1;
 
     mqtt_config->network.reconnect_timeout_ms = 10000; // 10 seconds
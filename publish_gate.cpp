@@ -0,0 +1,124 @@
+#include <apptools/publish_gate.h>
+#include "esp_timer.h"
+#include "esp_log.h"
+
+static const char *TAG = "publish_gate";
+
+// percent of the outbox budget each priority may fill
+static const uint8_t s_budget_share[publish_gate::PRIORITY_COUNT] = {100, 75, 50};
+
+static const publish_telemetry::path_t s_telemetry_path[publish_gate::PRIORITY_COUNT] = {
+    publish_telemetry::PATH_DISCOVERY, publish_telemetry::PATH_STATE, publish_telemetry::PATH_LOGS
+};
+
+publish_gate::publish_gate() : mqtt5_mutex_(xSemaphoreCreateMutex()) {
+}
+
+publish_gate::~publish_gate() {
+    if (mqtt5_mutex_)
+        vSemaphoreDelete(mqtt5_mutex_);
+}
+
+void publish_gate::set_connected(bool connected) {
+    // a new connection starts without aliases, the broker forgot them
+    if (connected)
+        connection_++;
+    connected_ = connected;
+}
+
+size_t publish_gate::outbox_size() const {
+    int size = client_ ? esp_mqtt_client_get_outbox_size(client_) : 0;
+    return size > 0 ? size : 0;
+}
+
+bool publish_gate::admit(size_t len, priority_t priority) const {
+    // qos 0 traffic is never worth queueing while the broker is away
+    if (!connected_ && priority != PRIORITY_DISCOVERY)
+        return false;
+    return outbox_size() + len <= budget_ * s_budget_share[priority] / 100;
+}
+
+int publish_gate::publish(const char *topic, const char *data, size_t len, int qos, int retain, priority_t priority) {
+    if (!admit(len, priority)) {
+        switch (priority) {
+            case PRIORITY_DISCOVERY:
+                refused_++;
+                break;
+            case PRIORITY_STATE:
+                holding_state_ = true;
+                coalesced_++;
+                break;
+            default:
+                dropped_++;
+                dropped_bytes_ += len;
+                break;
+        }
+        return -1;
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    int msg_id;
+#if CONFIG_MQTT_PROTOCOL_5
+    if (mqtt5_) {
+        xSemaphoreTake(mqtt5_mutex_, portMAX_DELAY);
+        uint32_t connection = connection_;
+        if (alias_connection_ != connection) {
+            alias_connection_ = connection;
+            alias_limit_ = alias_max_;
+        }
+
+        // qos 0 only - a message retransmitted on a later connection would carry an alias the broker forgot
+        uint16_t alias = priority == PRIORITY_STATE && qos == 0 ? alias_for(topic) : 0;
+        if (alias > alias_limit_)
+            alias = 0;
+        esp_mqtt5_publish_property_config_t property = {};
+        property.message_expiry_interval = expiry_s_[priority];
+        property.topic_alias = alias;
+        if (esp_mqtt5_client_set_publish_property(client_, &property) != ESP_OK && alias) {
+            // over the broker's topic alias maximum - keep the expiry, no aliases from here on this connection
+            ESP_LOGW(TAG, "Topic alias %d refused by the broker, using %d until reconnect", alias, alias - 1);
+            alias_limit_ = alias - 1;
+            alias = 0;
+            property.topic_alias = 0;
+            esp_mqtt5_client_set_publish_property(client_, &property);
+        }
+
+        bool established = alias && aliases_[alias - 1].connection == connection;
+        msg_id = esp_mqtt_client_publish(client_, established ? "" : topic, data, len, qos, retain);
+        if (alias && msg_id >= 0)
+            aliases_[alias - 1].connection = connection;
+        xSemaphoreGive(mqtt5_mutex_);
+    } else
+#endif
+    msg_id = esp_mqtt_client_publish(client_, topic, data, len, qos, retain);
+
+    if (msg_id >= 0)
+        sent_++;
+    if (telemetry_)
+        telemetry_->record(s_telemetry_path[priority], esp_timer_get_time() - start_us, len, msg_id >= 0);
+    return msg_id;
+}
+
+// topics are interned so the pointer is the identity, 0 == no alias left
+uint16_t publish_gate::alias_for(const char *topic) {
+    for (size_t i = 0; i < aliases_.size(); i++) {
+        if (aliases_[i].topic == topic)
+            return i + 1;
+    }
+    if (aliases_.size() >= alias_max_)
+        return 0;
+    aliases_.push_back({topic, 0});
+    return aliases_.size();
+}
+
+bool publish_gate::take_recovered() {
+    if (!holding_state_ || !connected_)
+        return false;
+    if (outbox_size() > budget_ * s_budget_share[PRIORITY_STATE] / 200)
+        return false;
+    return holding_state_.exchange(false);
+}
+
+publish_gate::stats_t publish_gate::stats() const {
+    return {sent_, coalesced_, dropped_, dropped_bytes_, refused_};
+}
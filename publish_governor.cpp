@@ -0,0 +1,44 @@
+#include <apptools/publish_governor.h>
+#include <algorithm>
+
+// how much of the way back to the target we go per update when pressure drops
+#define TIGHTEN_DIVISOR 4
+
+// 0 at low, 100 at high and above
+static uint32_t ramp(float value, float low, float high) {
+    if (value <= low)
+        return 0;
+    if (value >= high || high <= low)
+        return 100;
+    return (uint32_t) ((value - low) * 100 / (high - low));
+}
+
+void publish_governor::update(float cpu_pct, uint32_t free_heap, uint32_t outbox_pct) {
+    if (!config_.enabled)
+        return;
+
+    cpu_pct_ = cpu_pct;
+    uint32_t pressure = std::min<uint32_t>(outbox_pct, 100);
+    if (cpu_pct >= 0)
+        pressure = std::max(pressure, ramp(cpu_pct, config_.cpu_busy_pct, config_.cpu_saturated_pct));
+    // less heap is more pressure - ramp on the bytes missing below the low mark
+    pressure = std::max(pressure, ramp((float) config_.heap_low_bytes - free_heap, 0,
+                                       (float) config_.heap_low_bytes - config_.heap_critical_bytes));
+    pressure_pct_ = pressure;
+
+    uint32_t max_pct = std::max<uint32_t>(config_.max_stretch, 1) * 100;
+    uint32_t target = 100 + pressure * (max_pct - 100) / 100;
+    if (target >= stretch_pct_) {
+        stretch_pct_ = target;
+    } else {
+        uint32_t step = std::max<uint32_t>((stretch_pct_ - target) / TIGHTEN_DIVISOR, 1);
+        stretch_pct_ -= step;
+    }
+}
+
+uint32_t publish_governor::interval_ms(uint32_t min_ms, uint32_t max_ms) const {
+    if (!config_.enabled || stretch_pct_ <= 100)
+        return min_ms;
+    uint64_t stretched = (uint64_t) min_ms * stretch_pct_ / 100;
+    return (uint32_t) std::max<uint64_t>(std::min<uint64_t>(stretched, max_ms), min_ms);
+}
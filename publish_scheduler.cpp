@@ -0,0 +1,32 @@
+#include <apptools/publish_scheduler.h>
+#include <algorithm>
+#include <climits>
+
+static bool later_deadline(const publish_scheduler::entry_t &a, const publish_scheduler::entry_t &b) {
+    return a.deadline_ms > b.deadline_ms;
+}
+
+void publish_scheduler::push(const entry_t &entry) {
+    heap_.push_back(entry);
+    std::push_heap(heap_.begin(), heap_.end(), later_deadline);
+}
+
+int64_t publish_scheduler::next_deadline_ms() const {
+    if (heap_.empty())
+        return INT64_MAX;
+    return heap_.front().deadline_ms;
+}
+
+void publish_scheduler::pop_due(int64_t now_ms, bool force, std::vector<entry_t> &due) {
+    size_t first = due.size();
+    while (!heap_.empty() && (force || heap_.front().deadline_ms <= now_ms)) {
+        std::pop_heap(heap_.begin(), heap_.end(), later_deadline);
+        due.push_back(heap_.back());
+        heap_.pop_back();
+    }
+
+    // group by device and keep registration order so the json looks the same every time
+    std::sort(due.begin() + first, due.end(), [](const entry_t &a, const entry_t &b) {
+        return a.device != b.device ? a.device < b.device : a.slot < b.slot;
+    });
+}
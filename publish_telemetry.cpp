@@ -0,0 +1,71 @@
+#include <apptools/publish_telemetry.h>
+
+static int bucket_of(uint32_t us) {
+    int bucket = 0;
+    for (uint32_t limit = publish_telemetry::FIRST_BUCKET_US; us >= limit && bucket < publish_telemetry::BUCKETS - 1;
+         limit <<= 1)
+        bucket++;
+    return bucket;
+}
+
+void publish_telemetry::record(path_t path, uint32_t us, size_t bytes, bool ok) {
+    counters_t &c = paths_[path];
+    if (ok) {
+        c.messages.fetch_add(1, std::memory_order_relaxed);
+        c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    } else {
+        c.failures.fetch_add(1, std::memory_order_relaxed);
+    }
+    c.buckets[bucket_of(us)].fetch_add(1, std::memory_order_relaxed);
+
+    uint32_t max = c.max_us.load(std::memory_order_relaxed);
+    while (us > max && !c.max_us.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+    }
+}
+
+publish_telemetry::path_stats_t publish_telemetry::stats(path_t path) const {
+    const counters_t &c = paths_[path];
+    path_stats_t s;
+    s.messages = c.messages.load(std::memory_order_relaxed);
+    s.bytes = c.bytes.load(std::memory_order_relaxed);
+    s.failures = c.failures.load(std::memory_order_relaxed);
+    s.max_us = c.max_us.load(std::memory_order_relaxed);
+    for (int i = 0; i < BUCKETS; i++)
+        s.buckets[i] = c.buckets[i].load(std::memory_order_relaxed);
+    return s;
+}
+
+uint32_t publish_telemetry::path_stats_t::samples() const {
+    uint32_t n = 0;
+    for (uint32_t b : buckets)
+        n += b;
+    return n;
+}
+
+uint32_t publish_telemetry::path_stats_t::percentile_us(int pct) const {
+    uint32_t n = samples();
+    if (n == 0)
+        return 0;
+
+    // rank of the sample we are looking for, 1 based
+    uint32_t rank = ((uint64_t) n * pct + 99) / 100;
+    if (rank == 0)
+        rank = 1;
+    uint32_t seen = 0;
+    for (int i = 0; i < BUCKETS - 1; i++) {
+        seen += buckets[i];
+        if (seen >= rank)
+            return FIRST_BUCKET_US << i;
+    }
+    return max_us;
+}
+
+publish_telemetry::path_stats_t publish_telemetry::path_stats_t::since(const path_stats_t &before) const {
+    path_stats_t d = *this;
+    d.messages -= before.messages;
+    d.bytes -= before.bytes;
+    d.failures -= before.failures;
+    for (int i = 0; i < BUCKETS; i++)
+        d.buckets[i] -= before.buckets[i];
+    return d;
+}
@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""
+Republishes cbor state messages as json so home assistant can read them.
+
+The device publishes to <root>/<eid>[/<sub eid>]/state/cbor when the state encoding is CBOR,
+discovery still points home assistant at <...>/state - this bridge fills that topic.
+
+    pip install paho-mqtt
+    cbor_bridge.py --host broker.local [--root huzza32]
+"""
+import argparse
+import json
+import struct
+
+import paho.mqtt.client as mqtt
+
+
+class _Break(Exception):
+    pass
+
+
+def _decode(data, pos):
+    initial = data[pos]
+    pos += 1
+    major, info = initial >> 5, initial & 0x1f
+
+    if initial == 0xff:
+        raise _Break(pos)
+    if major == 7:
+        if info == 20:
+            return False, pos
+        if info == 21:
+            return True, pos
+        if info in (22, 23):
+            return None, pos
+        if info == 25:
+            return struct.unpack_from(">e", data, pos)[0], pos + 2
+        if info == 26:
+            # shortest text that reads back as the same float32
+            return float("%.7g" % struct.unpack_from(">f", data, pos)[0]), pos + 4
+        if info == 27:
+            return struct.unpack_from(">d", data, pos)[0], pos + 8
+        raise ValueError("unsupported simple value %d" % info)
+
+    if info < 24:
+        arg = info
+    elif info in (24, 25, 26, 27):
+        size = 1 << (info - 24)
+        arg = int.from_bytes(data[pos:pos + size], "big")
+        pos += size
+    elif info == 31 and major in (4, 5):
+        arg = None
+    else:
+        raise ValueError("unsupported length %d" % info)
+
+    if major == 0:
+        return arg, pos
+    if major == 1:
+        return -1 - arg, pos
+    if major in (2, 3):
+        raw = data[pos:pos + arg]
+        return (raw.decode() if major == 3 else raw.hex()), pos + arg
+    if major == 4:
+        items = []
+        while arg is None or len(items) < arg:
+            try:
+                item, pos = _decode(data, pos)
+            except _Break as b:
+                return items, b.args[0]
+            items.append(item)
+        return items, pos
+    if major == 5:
+        result = {}
+        while arg is None or len(result) < arg:
+            try:
+                key, pos = _decode(data, pos)
+            except _Break as b:
+                return result, b.args[0]
+            result[key], pos = _decode(data, pos)
+        return result, pos
+    raise ValueError("unsupported major type %d" % major)
+
+
+def cbor_to_json(payload):
+    value, _ = _decode(payload, 0)
+    return json.dumps(value, separators=(",", ":"))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="localhost")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--username")
+    parser.add_argument("--password")
+    parser.add_argument("--root", default="huzza32", help="MQTT_ROOT_TOPIC of the devices")
+    args = parser.parse_args()
+
+    client = mqtt.Client()
+    if args.username:
+        client.username_pw_set(args.username, args.password)
+
+    def on_connect(client, userdata, flags, rc):
+        client.subscribe(args.root + "/+/state/cbor")
+        client.subscribe(args.root + "/+/+/state/cbor")
+
+    def on_message(client, userdata, msg):
+        try:
+            text = cbor_to_json(msg.payload)
+        except (ValueError, IndexError, UnicodeDecodeError) as e:
+            print("dropping %s: %s" % (msg.topic, e))
+            return
+        client.publish(msg.topic[:-len("/cbor")], text)
+
+    client.on_connect = on_connect
+    client.on_message = on_message
+    client.connect(args.host, args.port)
+    client.loop_forever()
+
+
+if __name__ == "__main__":
+    main()
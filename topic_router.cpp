@@ -0,0 +1,54 @@
+#include <apptools/topic_router.h>
+#include <apptools/hash_utils.h>
+#include <algorithm>
+#include <cstring>
+
+topic_router::route_t &topic_router::insert(const char *topic) {
+    uint16_t len = strlen(topic);
+    uint32_t hash = fnv1a_32(topic, len);
+
+    auto it = std::lower_bound(routes_.begin(), routes_.end(), hash, [](const route_t &route, uint32_t h) {
+        return route.hash < h;
+    });
+    for (auto same = it; same != routes_.end() && same->hash == hash; ++same) {
+        if (same->topic_len == len && memcmp(same->topic, topic, len) == 0)
+            return *same;
+    }
+    return *routes_.insert(it, {hash, len, topic, nullptr, nullptr});
+}
+
+void topic_router::add(const char *topic, handler_t handler) {
+    route_t &route = insert(topic);
+    route.handler = handler;
+    route.chunk_handler = nullptr;
+}
+
+void topic_router::add_chunked(const char *topic, chunk_handler_t handler) {
+    route_t &route = insert(topic);
+    route.handler = nullptr;
+    route.chunk_handler = handler;
+}
+
+const topic_router::route_t *topic_router::find(const char *topic, int topic_len) const {
+    uint32_t hash = fnv1a_32(topic, topic_len);
+
+    auto it = std::lower_bound(routes_.begin(), routes_.end(), hash, [](const route_t &route, uint32_t h) {
+        return route.hash < h;
+    });
+    for (; it != routes_.end() && it->hash == hash; ++it) {
+        if (it->topic_len == topic_len && memcmp(it->topic, topic, topic_len) == 0)
+            return &*it;
+    }
+    return nullptr;
+}
+
+bool topic_router::dispatch(const char *topic, int topic_len, const char *data, int data_len) const {
+    const route_t *route = find(topic, topic_len);
+    if (!route)
+        return false;
+    if (route->chunk_handler)
+        route->chunk_handler(data, data_len, 0, data_len);
+    else
+        route->handler(data, data_len);
+    return true;
+}
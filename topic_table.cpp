@@ -0,0 +1,55 @@
+#include <apptools/topic_table.h>
+#include <apptools/hash_utils.h>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#define MAX_INTERNED_TOPIC_LEN 256 // must fit in a block
+
+topic_table::~topic_table() {
+    for (auto block : blocks_)
+        delete[] block;
+}
+
+char *topic_table::allocate(size_t len) {
+    if (block_used_ + len > BLOCK_SIZE) {
+        char *block = new(std::nothrow) char[BLOCK_SIZE];
+        if (!block)
+            return nullptr;
+        blocks_.push_back(block);
+        blocks_bytes_ += BLOCK_SIZE;
+        block_used_ = 0;
+    }
+
+    char *p = blocks_.back() + block_used_;
+    block_used_ += len;
+    return p;
+}
+
+const char *topic_table::intern(const char *fmt, ...) {
+    char topic[MAX_INTERNED_TOPIC_LEN];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(topic, sizeof(topic), fmt, args);
+    va_end(args);
+    if (len < 0 || len >= (int) sizeof(topic))
+        return nullptr;
+
+    uint32_t hash = fnv1a_32(topic, len);
+    for (const auto &entry : entries_) {
+        if (entry.hash == hash && strcmp(entry.str, topic) == 0)
+            return entry.str;
+    }
+
+    char *p = allocate(len + 1);
+    if (!p)
+        return nullptr;
+    memcpy(p, topic, len + 1);
+    entries_.push_back({hash, p});
+    return p;
+}
+
+size_t topic_table::footprint() const {
+    return blocks_bytes_ + blocks_.capacity() * sizeof(char *) + entries_.capacity() * sizeof(entry_t);
+}